@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "complete.h"
+#include "shell.h"
+
+/*
+ * Benchmarks for the shell's hot paths. Each result is printed and also
+ * written as JSON to the file given with -o so runs can be compared.
+ *
+ *   dash-bench [-q] [-t tasks] [-o results.json]
+ *
+ * -t starts that many idle processes first, so the psvis numbers can be
+ * taken with a large process table (50k+) on an ordinary host.
+ */
+
+struct result {
+	char name[64];
+	double value;
+	const char *unit;
+};
+
+static struct result results[64];
+static int result_count;
+static char tmp_dir[] = "/tmp/dash-bench.XXXXXX";
+static bool quick;
+static long extra_tasks;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double value, const char *unit) {
+	struct result *r = &results[result_count++];
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->value = value;
+	r->unit = unit;
+	printf("%-32s %12.3f %s\n", name, value, unit);
+	fflush(stdout);
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// parse and run a command line through the shell's own executor
+static int run_line(const char *line) {
+	struct command_t *command = calloc(1, sizeof(struct command_t));
+	char *buf = strdup(line);
+	int code = -1;
+	if (parse_command(buf, command) == 0)
+		code = process_command(command);
+	free_command(command);
+	free(buf);
+	return code;
+}
+
+static void make_file(const char *path, size_t size) {
+	char block[65536];
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	for (size_t i = 0; i < sizeof(block); i++)
+		block[i] = (char)(i * 131 + (i >> 7));
+	for (size_t done = 0; done < size; done += sizeof(block)) {
+		size_t n = size - done < sizeof(block) ? size - done : sizeof(block);
+		if (write(fd, block, n) != (ssize_t)n) {
+			perror(path);
+			exit(1);
+		}
+	}
+	close(fd);
+}
+
+static void bench_spawn(void) {
+	int runs = quick ? 100 : 1000;
+	double *samples = malloc(sizeof(double) * runs);
+	double total = 0;
+
+	run_line("true"); // warm up the page cache
+	for (int i = 0; i < runs; i++) {
+		double start = now();
+		run_line("true");
+		samples[i] = (now() - start) * 1e6;
+		total += samples[i];
+	}
+	qsort(samples, runs, sizeof(double), cmp_double);
+	report("spawn_latency_mean", total / runs, "us");
+	report("spawn_latency_p50", samples[runs / 2], "us");
+	report("spawn_latency_p99", samples[runs * 99 / 100], "us");
+	free(samples);
+}
+
+static void bench_pipeline(void) {
+	size_t size = (quick ? 16 : 256) << 20;
+	char path[256], line[4096], name[64];
+	snprintf(path, sizeof(path), "%s/pipe.dat", tmp_dir);
+	make_file(path, size);
+
+	// default pipes, then 1 MiB ones through DASH_PIPE_SIZE
+	for (int big = 0; big <= 1; big++) {
+		if (big)
+			setenv("DASH_PIPE_SIZE", "1m", 1);
+		for (int stages = 1; stages <= 8; stages *= 2) {
+			int len = snprintf(line, sizeof(line), "cat %s", path);
+			for (int i = 1; i < stages; i++)
+				len += snprintf(line + len, sizeof(line) - len, " | cat");
+			snprintf(line + len, sizeof(line) - len, " > /dev/null");
+
+			double start = now();
+			run_line(line);
+			double elapsed = now() - start;
+			snprintf(name, sizeof(name), "pipeline_%d_stage%s", stages,
+					 big ? "_1m_pipes" : "");
+			report(name, size / elapsed / 1e6, "MB/s");
+		}
+	}
+	unsetenv("DASH_PIPE_SIZE");
+	unlink(path);
+}
+
+static void bench_complete(void) {
+	int files = 10000, runs = quick ? 5 : 20;
+	char path[512], bin_dir[256], cwd[4096];
+	static char matches[COMPLETE_MAX_MATCHES][COMPLETE_NAME_MAX];
+	const char *old_path = getenv("PATH");
+	char *saved_path = old_path ? strdup(old_path) : NULL;
+
+	snprintf(bin_dir, sizeof(bin_dir), "%s/bin", tmp_dir);
+	mkdir(bin_dir, 0755);
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/cmd_%05d", bin_dir, i);
+		int fd = open(path, O_WRONLY | O_CREAT, 0755);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	// complete from an empty directory so only PATH is scanned
+	snprintf(path, sizeof(path), "%s/empty", tmp_dir);
+	mkdir(path, 0755);
+	if (!getcwd(cwd, sizeof(cwd)) || chdir(path) < 0) {
+		perror("chdir");
+		return;
+	}
+	setenv("PATH", bin_dir, 1);
+
+	const char *prefixes[] = { "cmd_0999", "cmd_0", "zzz" };
+	const char *names[] = { "complete_10k_narrow", "complete_10k_wide",
+							"complete_10k_none" };
+	for (int p = 0; p < 3; p++) {
+		double start = now();
+		for (int i = 0; i < runs; i++)
+			completion_matches(prefixes[p], matches, COMPLETE_MAX_MATCHES);
+		report(names[p], (now() - start) / runs * 1e3, "ms");
+	}
+
+	if (saved_path)
+		setenv("PATH", saved_path, 1);
+	free(saved_path);
+	if (chdir(cwd) < 0)
+		perror(cwd);
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/cmd_%05d", bin_dir, i);
+		unlink(path);
+	}
+	rmdir(bin_dir);
+	snprintf(path, sizeof(path), "%s/empty", tmp_dir);
+	rmdir(path);
+}
+
+static void bench_parse(void) {
+	char name[64];
+
+	for (int args = 1000; args <= (quick ? 10000 : 100000); args *= 10) {
+		size_t cap = (size_t)args * 24 + 64, len = 0;
+		char *line = malloc(cap), *copy = malloc(cap);
+		len += snprintf(line, cap, "cmd");
+		for (int i = 0; i < args; i++) {
+			len += snprintf(line + len, cap - len,
+							i % 3 ? " argument_%d" : " \"quoted %d\"", i);
+		}
+		len += snprintf(line + len, cap - len, " < in | sort > out");
+
+		double best = 1e9;
+		for (int run = 0; run < 5; run++) {
+			struct command_t *command = calloc(1, sizeof(struct command_t));
+			memcpy(copy, line, len + 1);
+			double start = now();
+			parse_command(copy, command);
+			double elapsed = now() - start;
+			free_command(command);
+			if (elapsed < best)
+				best = elapsed;
+		}
+		snprintf(name, sizeof(name), "parse_%d_args", args);
+		report(name, best * 1e3, "ms");
+		snprintf(name, sizeof(name), "parse_%d_args_per_arg", args);
+		report(name, best * 1e9 / args, "ns");
+		free(line);
+		free(copy);
+	}
+}
+
+static void bench_kuhex(void) {
+	size_t size = (quick ? 4 : 32) << 20;
+	char path[256], name[64];
+	snprintf(path, sizeof(path), "%s/kuhex.dat", tmp_dir);
+	make_file(path, size);
+
+	FILE *out = fopen("/dev/null", "w");
+	for (int group = 1; group <= 16; group *= 2) {
+		double start = now();
+		kuhex(path, group, out);
+		fflush(out);
+		double elapsed = now() - start;
+		snprintf(name, sizeof(name), "kuhex_g%d", group);
+		report(name, size / elapsed / 1e6, "MB/s");
+	}
+	fclose(out);
+
+	// and back, rated by the bytes rebuilt
+	char dump[256], rebuilt[256];
+	snprintf(dump, sizeof(dump), "%s/kuhex.txt", tmp_dir);
+	snprintf(rebuilt, sizeof(rebuilt), "%s/kuhex.out", tmp_dir);
+	out = fopen(dump, "w");
+	if (out) {
+		kuhex(path, 4, out);
+		fclose(out);
+		double start = now();
+		kuhex_reverse(dump, rebuilt);
+		report("kuhex_reverse", size / (now() - start) / 1e6, "MB/s");
+	}
+	unlink(dump);
+	unlink(rebuilt);
+	unlink(path);
+}
+
+// processes on the host, what psvis has to walk
+static long count_tasks(void) {
+	DIR *proc = opendir("/proc");
+	struct dirent *d;
+	long count = 0;
+	while (proc && (d = readdir(proc))) {
+		if (d->d_name[0] >= '1' && d->d_name[0] <= '9')
+			count++;
+	}
+	if (proc)
+		closedir(proc);
+	return count;
+}
+
+static void bench_psvis(void) {
+	int runs = quick ? 3 : 10;
+	pid_t *children = calloc(extra_tasks ? extra_tasks : 1, sizeof(pid_t));
+	long started = 0;
+
+	for (; started < extra_tasks; started++) {
+		pid_t child = fork();
+		if (child < 0) {
+			perror("fork");
+			break;
+		}
+		if (child == 0) {
+			pause();
+			_exit(0);
+		}
+		children[started] = child;
+	}
+	report("psvis_tasks", count_tasks(), "tasks");
+
+	int out = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	double best = 1e9;
+	for (int i = 0; i < runs; i++) {
+		double start = now();
+		psvis_scan(&(pid_t){ 1 }, 1, out);
+		if (now() - start < best)
+			best = now() - start;
+	}
+	report("psvis_scan", best * 1e3, "ms");
+
+	if (access("/proc/psvis_tree", F_OK) == 0) {
+		// a depth no tree reaches gives the whole tree under a query
+		// the module has not cached yet, so every run walks the tasks
+		char query[32];
+		best = 1e9;
+		for (int i = 0; i < runs; i++) {
+			snprintf(query, sizeof(query), "1 depth=%d", 1000000 + i);
+			double start = now();
+			psvis_module(query, out);
+			if (now() - start < best)
+				best = now() - start;
+		}
+		report("psvis_module_cold", best * 1e3, "ms");
+
+		// the same query again, served from the module's cache when the
+		// tree did not change in between
+		psvis_module("1", out);
+		best = 1e9;
+		for (int i = 0; i < runs; i++) {
+			double start = now();
+			psvis_module("1", out);
+			if (now() - start < best)
+				best = now() - start;
+		}
+		report("psvis_module_warm", best * 1e3, "ms");
+	}
+	close(out);
+
+	for (long i = 0; i < started; i++)
+		kill(children[i], SIGKILL);
+	for (long i = 0; i < started; i++)
+		waitpid(children[i], NULL, 0);
+	free(children);
+}
+
+static int write_results(const char *file) {
+	FILE *out = fopen(file, "w");
+	if (!out) {
+		perror(file);
+		return 1;
+	}
+	fprintf(out, "{\n  \"version\": 1,\n  \"timestamp\": %ld,\n", (long)time(NULL));
+	fprintf(out, "  \"results\": [\n");
+	for (int i = 0; i < result_count; i++) {
+		fprintf(out, "    {\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}%s\n",
+				results[i].name, results[i].value, results[i].unit,
+				i + 1 < result_count ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+	fclose(out);
+	printf("results written to %s\n", file);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *out_file = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "qt:o:")) != -1) {
+		switch (opt) {
+		case 'q':
+			quick = true;
+			break;
+		case 't':
+			extra_tasks = atol(optarg);
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-q] [-t tasks] [-o results.json]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (!mkdtemp(tmp_dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	bench_spawn();
+	bench_pipeline();
+	bench_complete();
+	bench_parse();
+	bench_kuhex();
+	bench_psvis();
+
+	rmdir(tmp_dir);
+	return out_file ? write_results(out_file) : 0;
+}
@@ -0,0 +1,924 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/reboot.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Stress and latency harness for the psvis module. For each tree shape it
+ * builds a synthetic process tree, reads /proc/psvis_tree for it while
+ * nothing changes and then while the root forks and reaps children as
+ * fast as it can, and checks every read for a well-formed tree:
+ *
+ *   chain   every process has one child, a tree as deep as it is big
+ *   fan     one process with every other one as its child
+ *   mixed   a wide top with branches of random width and depth below
+ *
+ *   psvis-stress [-q] [-n nodes] [-r reads] [-s shape] [-m module.ko]
+ *                [-o results.json]
+ *
+ * The processes of a tree share one address space (clone with CLONE_VM
+ * but not CLONE_THREAD, made without libc so that none of them writes the
+ * TLS they share), so each one costs the kernel a task and a stack but no
+ * page tables, and 50k of them fit in a small VM. The quiet reads
+ * each ask for a depth no tree reaches, which the module has not cached,
+ * so every one of them walks the tree; a few more plain reads give the
+ * latency of a cache hit. When the stack tracer is available, the deepest
+ * kernel stack seen from the cold read to the end of the quiet reads is
+ * reported as well.
+ *
+ * After the shapes, a small tree of forked processes checks that cached
+ * reads follow an exit: once the exiting process's child has been handed
+ * to the harness, and again once the zombie has been reaped. -s exits runs
+ * only that check.
+ *
+ * pid_max and threads-max are raised for the run when they are lower than
+ * the biggest tree needs, and put back before the harness exits.
+ *
+ * Running it as init, as bench/qemu-stress.sh does, mounts what it needs,
+ * loads the module from /mymodule.ko, prints the results as JSON between
+ * marker lines on the console and powers the machine off.
+ */
+
+#define TREE_PATH "/proc/psvis_tree"
+#define STACK_SIZE (16 * 1024)
+#define MAX_DEPTH 1000 // of a mixed tree
+#define BUILD_TIMEOUT 60 // seconds without a new process
+
+enum shape { CHAIN, FAN, MIXED, SHAPES };
+
+static const char *shape_names[] = { "chain", "fan", "mixed" };
+static const long default_nodes[] = { 10000, 50000, 20000 };
+
+// shared between the harness and the processes of the tree
+struct tree {
+	enum shape shape;
+	long nodes; // processes below the root
+	atomic_long created; // slots claimed, can go past nodes
+	atomic_long failed; // claimed slots clone() failed for
+	atomic_long ready; // processes done spawning their children
+	atomic_ulong seed;
+	atomic_int churn; // the root forks and reaps while set
+	atomic_long churned;
+};
+
+struct result {
+	char name[64];
+	double value;
+	const char *unit;
+};
+
+static struct tree *tree;
+static char *stacks; // in the root's address space, slot 0 for churn
+static struct result results[128];
+static int result_count;
+static bool quick;
+static int reads = 100;
+static long pid_max;
+static uint32_t *seen; // per pid, the check that saw it last
+static int *depths;
+static uint32_t check_id;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *shape, const char *name, double value,
+				   const char *unit) {
+	if (result_count == (int)(sizeof(results) / sizeof(results[0])))
+		return;
+	struct result *r = &results[result_count++];
+	snprintf(r->name, sizeof(r->name), "%s%s%s", shape ? shape : "",
+			 shape ? "_" : "", name);
+	r->value = value;
+	r->unit = unit;
+	printf("%-32s %12.3f %s\n", r->name, value, unit);
+	fflush(stdout);
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static bool write_file(const char *path, const char *value) {
+	int fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	bool ok = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+	close(fd);
+	return ok;
+}
+
+static long read_long(const char *path) {
+	char buf[32] = "";
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	return n > 0 ? atol(buf) : -1;
+}
+
+// children per process, the same for every run of a shape
+static long fanout(long depth) {
+	uint64_t x = atomic_fetch_add(&tree->seed, 1) * 0x9e3779b97f4a7c15ull;
+	x ^= x >> 29;
+
+	switch (tree->shape) {
+	case CHAIN:
+		return 1;
+	case FAN:
+		return depth == 0 ? tree->nodes : 0;
+	default:
+		if (depth < 2)
+			return 16;
+		return depth < MAX_DEPTH ? (long)(x % 4) : 0;
+	}
+}
+
+static int node_main(void *arg);
+
+#ifdef __x86_64__
+/*
+ * The processes of a tree share the harness's TLS, so errno and whatever
+ * libc keeps there too. Below the root they make raw system calls only:
+ * raw_clone() runs fn(arg) on the new stack and exits with its result
+ * without going through libc's wrapper, and neither call touches errno.
+ */
+static long raw_clone(unsigned long flags, void *stack, int (*fn)(void *),
+					  void *arg) {
+	register long ptid __asm__("rdx") = 0;
+	register long ctid __asm__("r10") = 0;
+	register long tls __asm__("r8") = 0;
+	register int (*call)(void *) __asm__("r9") = fn;
+	register void *call_arg __asm__("r12") = arg;
+	long ret;
+
+	__asm__ volatile("syscall\n\t"
+					 "test %%rax, %%rax\n\t"
+					 "jnz 1f\n\t"
+					 "xor %%ebp, %%ebp\n\t"
+					 "mov %%r12, %%rdi\n\t"
+					 "call *%%r9\n\t"
+					 "mov %%eax, %%edi\n\t"
+					 "mov %[exit], %%eax\n\t"
+					 "syscall\n\t"
+					 "hlt\n"
+					 "1:"
+					 : "=a"(ret)
+					 : "0"((long)SYS_clone), "D"(flags), "S"(stack),
+					   "r"(ptid), "r"(ctid), "r"(tls), "r"(call), "r"(call_arg),
+					   [exit] "i"(SYS_exit)
+					 : "rcx", "r11", "memory");
+	return ret;
+}
+
+static void raw_pause(void) {
+	long ret;
+	__asm__ volatile("syscall"
+					 : "=a"(ret)
+					 : "0"((long)SYS_pause)
+					 : "rcx", "r11", "memory");
+	(void)ret;
+}
+#else
+// elsewhere every process of a tree is forked, with page tables of its own
+static long raw_clone(unsigned long flags, void *stack, int (*fn)(void *),
+					  void *arg) {
+	(void)flags;
+	(void)stack;
+	pid_t pid = fork();
+	if (pid == 0)
+		_exit(fn(arg));
+	return pid;
+}
+
+static void raw_pause(void) { pause(); }
+#endif
+
+static bool spawn(long depth) {
+	long slot = atomic_fetch_add(&tree->created, 1);
+	if (slot >= tree->nodes)
+		return false;
+	if (raw_clone(CLONE_VM | SIGCHLD, stacks + (slot + 2) * STACK_SIZE,
+				  node_main, (void *)depth) < 0) {
+		atomic_fetch_add(&tree->failed, 1);
+		return false;
+	}
+	return true;
+}
+
+// runs on a shared address space, so no libc calls in here
+static int node_main(void *arg) {
+	long depth = (long)arg, kids = fanout(depth);
+
+	for (long i = 0; i < kids && spawn(depth + 1); i++)
+		;
+	atomic_fetch_add(&tree->ready, 1);
+	while (true)
+		raw_pause();
+	return 0;
+}
+
+static int churn_main(void *arg) {
+	(void)arg;
+	return 0;
+}
+
+// the root of the tree, forked by the harness
+static void root_main(void) {
+	setpgid(0, 0);
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	stacks = mmap(NULL, (tree->nodes + 2) * STACK_SIZE,
+				  PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1,
+				  0);
+	if (stacks == MAP_FAILED)
+		_exit(1);
+
+	long kids = fanout(0);
+	for (long i = 0; i < kids && spawn(1); i++)
+		;
+	atomic_fetch_add(&tree->ready, 1);
+
+	for (;;) {
+		if (!atomic_load(&tree->churn)) {
+			usleep(1000);
+			continue;
+		}
+		pid_t pid = raw_clone(CLONE_VM | SIGCHLD, stacks + STACK_SIZE,
+							  churn_main, NULL);
+		if (pid > 0 && waitpid(pid, NULL, 0) == pid)
+			atomic_fetch_add(&tree->churned, 1);
+	}
+}
+
+static long tree_size(void) {
+	long created = atomic_load(&tree->created);
+	if (created > tree->nodes)
+		created = tree->nodes;
+	return created - atomic_load(&tree->failed) + 1;
+}
+
+// start a tree and wait until all of it is there, returns the root
+static pid_t build(enum shape shape, long nodes) {
+	memset(tree, 0, sizeof(*tree));
+	tree->shape = shape;
+	tree->nodes = nodes;
+
+	pid_t root = fork();
+	if (root < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (root == 0)
+		root_main();
+	setpgid(root, root);
+
+	long last = -1;
+	double progress = now();
+	while (atomic_load(&tree->ready) != tree_size()) {
+		long ready = atomic_load(&tree->ready);
+		if (ready != last) {
+			last = ready;
+			progress = now();
+		} else if (now() - progress > BUILD_TIMEOUT) {
+			fprintf(stderr, "%s: stuck at %ld processes\n", shape_names[shape],
+					ready);
+			break;
+		}
+		if (waitpid(root, NULL, WNOHANG) == root) {
+			fprintf(stderr, "%s: root exited\n", shape_names[shape]);
+			return -1;
+		}
+		usleep(1000);
+	}
+	if (atomic_load(&tree->failed))
+		fprintf(stderr, "%s: clone failed for %ld processes\n",
+				shape_names[shape], atomic_load(&tree->failed));
+	return root;
+}
+
+// kill the tree and reap it, its processes were reparented to us
+static void teardown(pid_t root) {
+	kill(-root, SIGKILL);
+	while (waitpid(-1, NULL, __WALL) > 0 || errno == EINTR)
+		;
+}
+
+/*
+ * Read the whole tree under root, returns the length or -1. Unless cached,
+ * the query has a depth limit no other read used, so the module walks the
+ * tree instead of serving a render it kept.
+ */
+static ssize_t read_tree(pid_t root, bool cached, char **buf, size_t *cap) {
+	static int uncached;
+	char query[48];
+	size_t len = 0;
+	ssize_t n;
+
+	int fd = open(TREE_PATH, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (cached)
+		snprintf(query, sizeof(query), "%d", root);
+	else
+		snprintf(query, sizeof(query), "%d depth=%d", root,
+				 (1 << 30) + uncached++);
+	if (write(fd, query, strlen(query)) < 0) {
+		close(fd);
+		return -1;
+	}
+	do {
+		if (len == *cap) {
+			*cap = *cap ? *cap * 2 : 1 << 20;
+			char *grown = realloc(*buf, *cap);
+			if (!grown) {
+				close(fd);
+				return -1;
+			}
+			*buf = grown;
+		}
+		n = read(fd, *buf + len, *cap - len);
+		if (n > 0)
+			len += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+	close(fd);
+	return n < 0 ? -1 : (ssize_t)len;
+}
+
+static pid_t quoted_pid(const char *p) {
+	return *p == '"' ? (pid_t)strtol(p + 1, NULL, 10) : -1;
+}
+
+/*
+ * Check that buf is a DOT tree in pre-order: every edge starts at a node
+ * written before it and ends at a new one, and the node line after an
+ * edge is for its child. expect is the number of nodes, or -1 when the
+ * tree was changing. Returns NULL or what is wrong.
+ */
+static const char *check_tree(char *buf, size_t len, long expect,
+							  int *max_depth) {
+	static char err[96];
+	long nodes = 0;
+	pid_t child = -1; // of the edge on the line before
+	char *line = buf, *end = buf + len;
+
+	if (++check_id == 0) {
+		memset(seen, 0, sizeof(uint32_t) * pid_max);
+		check_id = 1;
+	}
+	*max_depth = 0;
+	if (len < 2 || strncmp(buf, "digraph ProcessTree {\n", 22) != 0)
+		return "no graph header";
+	if (end[-1] != '\n' || end[-2] != '}')
+		return "no closing brace";
+
+	for (line += 22; line < end - 2;) {
+		char *nl = memchr(line, '\n', end - line);
+		*nl = '\0';
+		pid_t pid = quoted_pid(line);
+		char *arrow = strstr(line, " -> ");
+
+		if (pid <= 0 || pid >= pid_max) {
+			snprintf(err, sizeof(err), "bad line: %.40s", line);
+			return err;
+		}
+		if (arrow) {
+			pid_t to = quoted_pid(arrow + 4);
+			if (seen[pid] != check_id)
+				return "edge from a node not written yet";
+			if (to <= 0 || to >= pid_max || seen[to] == check_id)
+				return "edge to a node written before";
+			seen[to] = check_id;
+			depths[to] = depths[pid] + 1;
+			if (depths[to] > *max_depth)
+				*max_depth = depths[to];
+			child = to;
+		} else {
+			if (child != pid && nodes > 0)
+				return "node line without its edge";
+			if (nodes == 0) {
+				seen[pid] = check_id;
+				depths[pid] = 0;
+			}
+			nodes++;
+			child = -1;
+		}
+		*nl = '\n';
+		line = nl + 1;
+	}
+	if (expect >= 0 && nodes != expect) {
+		snprintf(err, sizeof(err), "%ld nodes, expected %ld", nodes, expect);
+		return err;
+	}
+	return NULL;
+}
+
+static const char *stack_dir(void) {
+	if (access("/sys/kernel/tracing/stack_max_size", W_OK) == 0)
+		return "/sys/kernel/tracing";
+	if (access("/sys/kernel/debug/tracing/stack_max_size", W_OK) == 0)
+		return "/sys/kernel/debug/tracing";
+	return NULL;
+}
+
+static bool stack_tracer_start(void) {
+	char path[64];
+	const char *dir = stack_dir();
+
+	if (!dir)
+		return false;
+	snprintf(path, sizeof(path), "%s/stack_max_size", dir);
+	return write_file(path, "0") &&
+		   write_file("/proc/sys/kernel/stack_tracer_enabled", "1");
+}
+
+// deepest stack since the start, and whether psvis was on it
+static long stack_tracer_stop(bool *psvis) {
+	char path[64], line[256];
+	const char *dir = stack_dir();
+
+	write_file("/proc/sys/kernel/stack_tracer_enabled", "0");
+	snprintf(path, sizeof(path), "%s/stack_max_size", dir);
+	long max = read_long(path);
+
+	*psvis = false;
+	snprintf(path, sizeof(path), "%s/stack_trace", dir);
+	FILE *trace = fopen(path, "re");
+	while (trace && fgets(line, sizeof(line), trace))
+		*psvis = *psvis || strstr(line, "psvis");
+	if (trace)
+		fclose(trace);
+	return max;
+}
+
+// reads of the tree under root, returns the number that failed the check
+static int measure(const char *shape, const char *phase, pid_t root,
+				   long expect, bool quiet, bool cached) {
+	double *lat = calloc(reads, sizeof(double));
+	char *buf = NULL, name[48];
+	size_t cap = 0, bytes = 0;
+	double total = 0;
+	int errors = 0, depth = 0, done = 0;
+
+	for (int i = 0; i < reads; i++) {
+		double start = now();
+		ssize_t len = read_tree(root, cached, &buf, &cap);
+		lat[i] = now() - start;
+		if (len < 0) {
+			perror(TREE_PATH);
+			errors++;
+			break;
+		}
+		total += lat[i];
+		bytes += len;
+		done++;
+
+		const char *err = check_tree(buf, len, quiet ? expect : -1, &depth);
+		if (err && errors++ == 0)
+			fprintf(stderr, "%s %s read %d: %s\n", shape, phase, i, err);
+	}
+
+	if (done) {
+		qsort(lat, done, sizeof(double), cmp_double);
+		snprintf(name, sizeof(name), "%s_p50", phase);
+		report(shape, name, lat[done / 2] * 1e3, "ms");
+		snprintf(name, sizeof(name), "%s_p99", phase);
+		report(shape, name, lat[done * 99 / 100] * 1e3, "ms");
+		snprintf(name, sizeof(name), "%s_max", phase);
+		report(shape, name, lat[done - 1] * 1e3, "ms");
+		snprintf(name, sizeof(name), "%s_rate", phase);
+		report(shape, name, bytes / total / 1e6, "MB/s");
+	}
+	if (quiet)
+		report(shape, "depth", depth, "levels");
+	snprintf(name, sizeof(name), "%s_errors", phase);
+	report(shape, name, errors, "reads");
+	free(lat);
+	free(buf);
+	return errors;
+}
+
+static int run_shape(enum shape shape, long nodes) {
+	const char *name = shape_names[shape];
+	char *buf = NULL;
+	size_t cap = 0;
+	int errors = 0, depth;
+	bool psvis;
+
+	double start = now();
+	pid_t root = build(shape, nodes);
+	if (root < 0)
+		return 1;
+	long size = tree_size();
+	report(name, "nodes", size, "tasks");
+	report(name, "build", (now() - start) * 1e3, "ms");
+
+	// the first read of a tree walks it even with the cache
+	bool traced = stack_tracer_start();
+	start = now();
+	ssize_t len = read_tree(root, true, &buf, &cap);
+	report(name, "read_cold", (now() - start) * 1e3, "ms");
+	if (len < 0) {
+		perror(TREE_PATH);
+		errors++;
+	} else {
+		const char *err = check_tree(buf, len, size, &depth);
+		if (err) {
+			fprintf(stderr, "%s cold read: %s\n", name, err);
+			errors++;
+		}
+	}
+	free(buf);
+
+	errors += measure(name, "read", root, size, true, false);
+	if (traced) {
+		report(name, "kstack_max", stack_tracer_stop(&psvis), "bytes");
+		report(name, "kstack_psvis", psvis, "bool");
+	}
+	errors += measure(name, "cached", root, size, true, true);
+
+	long churned = atomic_load(&tree->churned);
+	atomic_store(&tree->churn, 1);
+	start = now();
+	errors += measure(name, "churn", root, -1, false, true);
+	atomic_store(&tree->churn, 0);
+	report(name, "churn_forks",
+		   (atomic_load(&tree->churned) - churned) / (now() - start),
+		   "forks/s");
+
+	teardown(root);
+	return errors;
+}
+
+// parent of pid in the DOT tree in buf, 0 for the root, -1 if not there
+static pid_t tree_parent(const char *buf, size_t len, pid_t pid) {
+	const char *line = buf, *end = buf + len;
+	bool first = true;
+
+	while (line < end) {
+		const char *nl = memchr(line, '\n', end - line);
+		if (!nl)
+			nl = end;
+		const char *arrow = memmem(line, nl - line, " -> ", 4);
+		if (arrow && quoted_pid(arrow + 4) == pid)
+			return quoted_pid(line);
+		if (!arrow && *line == '"') {
+			if (first && quoted_pid(line) == pid)
+				return 0;
+			first = false;
+		}
+		line = nl + 1;
+	}
+	return -1;
+}
+
+// state and parent of pid from /proc, false once it is reaped
+static bool proc_state(pid_t pid, char *state, pid_t *ppid) {
+	char path[32], buf[512];
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return false;
+	buf[n] = '\0';
+	char *p = strrchr(buf, ')');
+	return p && sscanf(p + 1, " %c %d", state, ppid) == 2;
+}
+
+/*
+ * Read the tree under root from the cache until pid hangs from want,
+ * -1 for gone. The generation bump of a reap comes with
+ * sched_process_free, an RCU grace period after the zombie is unlinked,
+ * so a read right after the reap may still see it. Returns false if the
+ * cache never catches up.
+ */
+static bool cached_parent_is(pid_t root, pid_t pid, pid_t want) {
+	char *buf = NULL;
+	size_t cap = 0;
+	pid_t got = -2;
+
+	for (int i = 0; i < 100 && got != want; i++) {
+		if (i > 0)
+			usleep(10000);
+		ssize_t len = read_tree(root, true, &buf, &cap);
+		got = len < 0 ? -2 : tree_parent(buf, len, pid);
+	}
+	free(buf);
+	return got == want;
+}
+
+// wait up to a second for pid to reach state under ppid, or be reaped
+static bool wait_state(pid_t pid, char want, pid_t want_ppid) {
+	char state;
+	pid_t ppid;
+
+	for (int i = 0; i < 1000; i++) {
+		bool alive = proc_state(pid, &state, &ppid);
+		if (want ? alive && state == want && ppid == want_ppid : !alive)
+			return true;
+		usleep(1000);
+	}
+	return false;
+}
+
+/*
+ * harness -> P -> C -> G, all forked. C exits, which hands G to the
+ * harness, the nearest subreaper, and leaves C a zombie under P; then P
+ * reaps C. Cached reads of both trees are primed before each step and
+ * have to show the tree after it.
+ */
+static int run_exits(void) {
+	int ready[2], quit[2], reap[2];
+	pid_t self = getpid(), p, c = -1, g = -1;
+	int errors = 0;
+	char byte;
+
+	if (pipe2(ready, O_CLOEXEC) < 0 || pipe2(quit, O_CLOEXEC) < 0 ||
+		pipe2(reap, O_CLOEXEC) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	p = fork();
+	if (p == 0) {
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		pid_t child = fork();
+		if (child == 0) {
+			if (fork() == 0) {
+				// no PR_SET_PDEATHSIG, G has to outlive C
+				pid_t ids[2] = { getppid(), getpid() };
+				write(ready[1], ids, sizeof(ids));
+				while (true)
+					pause();
+			}
+			read(quit[0], &byte, 1);
+			_exit(0);
+		}
+		read(reap[0], &byte, 1);
+		waitpid(child, NULL, 0);
+		while (true)
+			pause();
+	}
+	pid_t ids[2];
+	if (p < 0 || read(ready[0], ids, sizeof(ids)) != sizeof(ids)) {
+		perror("fork");
+		errors++;
+		goto out;
+	}
+	c = ids[0];
+	g = ids[1];
+
+	// prime both entries with G under C
+	if (!cached_parent_is(p, g, c) || !cached_parent_is(self, g, c)) {
+		fprintf(stderr, "exits: G not under C to begin with\n");
+		errors++;
+		goto out;
+	}
+
+	write(quit[1], "q", 1);
+	if (!wait_state(c, 'Z', p) || !wait_state(g, 'S', self)) {
+		fprintf(stderr, "exits: C did not exit or G was not reparented\n");
+		errors++;
+		goto out;
+	}
+	if (!cached_parent_is(self, g, self)) {
+		fprintf(stderr, "exits: cached tree keeps G under the exited C\n");
+		errors++;
+	}
+	if (!cached_parent_is(p, c, p) || !cached_parent_is(p, g, -1)) {
+		fprintf(stderr, "exits: cached tree of P is wrong after the exit\n");
+		errors++;
+	}
+
+	write(reap[1], "r", 1);
+	if (!wait_state(c, 0, 0)) {
+		fprintf(stderr, "exits: C was not reaped\n");
+		errors++;
+		goto out;
+	}
+	if (!cached_parent_is(p, c, -1) || !cached_parent_is(self, c, -1)) {
+		fprintf(stderr, "exits: cached tree keeps the reaped zombie\n");
+		errors++;
+	}
+
+out:
+	if (p > 0)
+		kill(p, SIGKILL);
+	if (g > 0)
+		kill(g, SIGKILL);
+	while (waitpid(-1, NULL, __WALL) > 0 || errno == EINTR)
+		;
+	for (int i = 0; i < 2; i++) {
+		close(ready[i]);
+		close(quit[i]);
+		close(reap[i]);
+	}
+	report("exits", "errors", errors, "checks");
+	return errors;
+}
+
+static int write_results(FILE *out) {
+	fprintf(out, "{\n  \"version\": 1,\n  \"timestamp\": %ld,\n",
+			(long)time(NULL));
+	fprintf(out, "  \"results\": [\n");
+	for (int i = 0; i < result_count; i++) {
+		fprintf(out,
+				"    {\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}%s\n",
+				results[i].name, results[i].value, results[i].unit,
+				i + 1 < result_count ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+	return fflush(out);
+}
+
+// as init nothing is mounted and there is no console on the standard fds
+static void init_setup(void) {
+	mkdir("/proc", 0755);
+	mkdir("/sys", 0755);
+	mkdir("/dev", 0755);
+	mount("proc", "/proc", "proc", 0, NULL);
+	mount("sysfs", "/sys", "sysfs", 0, NULL);
+	mount("devtmpfs", "/dev", "devtmpfs", 0, NULL);
+	mount("tracefs", "/sys/kernel/tracing", "tracefs", 0, NULL);
+
+	int fd = open("/dev/console", O_RDWR);
+	if (fd >= 0) {
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			close(fd);
+	}
+}
+
+static int load_module(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	int ret = syscall(SYS_finit_module, fd, "", 0);
+	close(fd);
+	if (ret < 0 && errno != EEXIST) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+#define LIMIT_MAX 4194304
+#define PID_MAX_PATH "/proc/sys/kernel/pid_max"
+#define THREADS_MAX_PATH "/proc/sys/kernel/threads-max"
+
+// the values raise_limits() replaced, empty if it left them alone
+static char old_pid_max[24], old_threads_max[24];
+
+static void raise_limit(const char *path, char *old, size_t size) {
+	long value = read_long(path);
+	char raised[24];
+
+	if (value < 0 || value >= LIMIT_MAX)
+		return;
+	snprintf(raised, sizeof(raised), "%d", LIMIT_MAX);
+	if (write_file(path, raised))
+		snprintf(old, size, "%ld", value);
+}
+
+// put back what raise_limits() changed, safe to call from a signal handler
+static void restore_limits(void) {
+	if (*old_pid_max)
+		write_file(PID_MAX_PATH, old_pid_max);
+	if (*old_threads_max)
+		write_file(THREADS_MAX_PATH, old_threads_max);
+}
+
+static void restore_and_exit(int sig) {
+	restore_limits();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+// room for the biggest tree, when running as root, until the harness exits
+static void raise_limits(void) {
+	struct rlimit unlimited = { RLIM_INFINITY, RLIM_INFINITY };
+
+	raise_limit(PID_MAX_PATH, old_pid_max, sizeof(old_pid_max));
+	raise_limit(THREADS_MAX_PATH, old_threads_max, sizeof(old_threads_max));
+	signal(SIGINT, restore_and_exit);
+	signal(SIGTERM, restore_and_exit);
+	signal(SIGHUP, restore_and_exit);
+	setrlimit(RLIMIT_NPROC, &unlimited);
+}
+
+int main(int argc, char *argv[]) {
+	const char *module = NULL, *out_file = NULL, *only = NULL;
+	bool is_init = getpid() == 1;
+	long nodes = 0;
+	int opt, errors = 0;
+
+	if (is_init) {
+		init_setup();
+		module = "/mymodule.ko";
+	}
+	while ((opt = getopt(argc, argv, "qn:r:s:m:o:")) != -1) {
+		switch (opt) {
+		case 'q':
+			quick = true;
+			break;
+		case 'n':
+			nodes = atol(optarg);
+			break;
+		case 'r':
+			reads = atoi(optarg);
+			break;
+		case 's':
+			only = optarg;
+			break;
+		case 'm':
+			module = optarg;
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		default:
+			fprintf(stderr,
+					"Usage: %s [-q] [-n nodes] [-r reads] [-s shape] "
+					"[-m module.ko] [-o results.json]\n",
+					argv[0]);
+			return 2;
+		}
+	}
+	if (quick)
+		reads = reads > 10 ? reads / 10 : reads;
+	if (reads < 1)
+		reads = 1;
+
+	raise_limits();
+	if (module && load_module(module) < 0)
+		errors++;
+	pid_max = read_long(PID_MAX_PATH);
+	tree = mmap(NULL, sizeof(*tree), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	seen = calloc(pid_max > 0 ? pid_max : 1, sizeof(uint32_t));
+	depths = calloc(pid_max > 0 ? pid_max : 1, sizeof(int));
+	if (pid_max <= 0 || tree == MAP_FAILED || !seen || !depths) {
+		perror("psvis-stress");
+		errors++;
+	} else if (access(TREE_PATH, R_OK | W_OK) != 0) {
+		perror(TREE_PATH);
+		errors++;
+	}
+
+	// orphans of a torn down tree are reaped here, not by init
+	prctl(PR_SET_CHILD_SUBREAPER, 1);
+	for (int s = 0; !errors && s < SHAPES; s++) {
+		if (only && strcmp(only, shape_names[s]) != 0)
+			continue;
+		long n = nodes ? nodes : default_nodes[s];
+		errors += run_shape(s, quick ? n / 10 : n);
+	}
+	if (!errors && (!only || strcmp(only, "exits") == 0))
+		errors += run_exits();
+	report(NULL, "errors", errors, "count");
+	restore_limits();
+
+	if (out_file) {
+		FILE *out = fopen(out_file, "w");
+		if (!out || write_results(out) != 0 || fclose(out) != 0)
+			perror(out_file);
+		else
+			printf("results written to %s\n", out_file);
+	}
+	if (is_init) {
+		printf("--- psvis-stress results ---\n");
+		write_results(stdout);
+		printf("--- end ---\n");
+		sync();
+		reboot(RB_POWER_OFF);
+	}
+	return errors != 0;
+}
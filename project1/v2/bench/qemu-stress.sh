@@ -0,0 +1,39 @@
+#!/bin/sh
+# Boot a kernel in QEMU with the psvis stress harness as init and copy its
+# results off the serial console.
+#
+#   bench/qemu-stress.sh KERNEL MODULE HARNESS OUT [harness flags...]
+#
+# MODULE has to be built for KERNEL (make KDIR=...). QEMU_MEM, QEMU_SMP and
+# QEMU_FLAGS are passed on to qemu-system-x86_64; the 50k process fan-out
+# wants about 4G.
+set -eu
+
+if [ $# -lt 4 ]; then
+	echo "Usage: $0 KERNEL MODULE HARNESS OUT [harness flags...]" >&2
+	exit 2
+fi
+kernel=$1 module=$2 harness=$3 out=$4
+shift 4
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+mkdir "$work/root"
+cp "$harness" "$work/root/init"
+cp "$module" "$work/root/mymodule.ko"
+(cd "$work/root" && find . | cpio -o -H newc --quiet) >"$work/initramfs"
+
+# everything after -- on the kernel command line goes to init
+qemu-system-x86_64 -machine accel=kvm:tcg -m "${QEMU_MEM:-4G}" \
+	-smp "${QEMU_SMP:-4}" -nographic -no-reboot ${QEMU_FLAGS:-} \
+	-kernel "$kernel" -initrd "$work/initramfs" \
+	-append "console=ttyS0 quiet panic=-1 -- $*" | tee "$work/console"
+
+tr -d '\r' <"$work/console" |
+	sed -n '/^--- psvis-stress results ---$/,/^--- end ---$/p' |
+	sed '1d;$d' >"$out"
+if [ ! -s "$out" ]; then
+	echo "$0: no results on the console" >&2
+	exit 1
+fi
+echo "results written to $out"
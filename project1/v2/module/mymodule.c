@@ -1,37 +1,1107 @@
+#include <linux/atomic.h>
+#include <linux/binfmts.h>
+#include <linux/capability.h>
+#include <linux/cred.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/kref.h>
 #include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/pid.h>
+#include <linux/poll.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/tracepoint.h>
+#include <linux/uio.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "psvis.h"
+
 #define PROCFS_NAME "psvis_tree"
 // Meta Information
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Ahmet Emir Benlice");
 MODULE_DESCRIPTION("A module that knows how to greet");
 
-static char input_pid[16] = "1"; // default to PID to 1
+/*
+ * A query is written to the file as
+ *
+ *   PID[,PID...] [depth=N] [threads] [uid=N] [comm=PREFIX] [stats] [delta]
+ *
+ * and applies to the file it was written to, so every reader can have its
+ * own. Several PIDs give their subtrees one after another in one read. A
+ * PID under one listed before it is left out, being in that subtree
+ * already, and the subtree of a later PID stops at an earlier one, so
+ * every task comes out at most once. depth limits how far below PID the
+ * walk goes, threads lists the
+ * other threads of each process under it, uid and comm keep only the
+ * tasks of that user or whose name starts with PREFIX. A task that fails
+ * a filter is skipped together with its subtree, the root is always
+ * shown. To query and read with one file, open it O_RDWR, write the query
+ * and read from offset 0.
+ *
+ * stats adds the state, user and system time, RSS, thread count and start
+ * time of each node, as DOT attributes or in the version 2 record fields.
+ * delta makes each read of the file after the first report only the
+ * nodes created, changed or exited since the previous one, remembered per
+ * file until the next query.
+ *
+ * A file opened only for writing sets the query that later opens start
+ * with, which keeps `echo PID > /proc/psvis_tree; cat /proc/psvis_tree`
+ * working.
+ */
+#define PSVIS_QUERY_MAX 256
+
+struct psvis_query {
+    pid_t pids[PSVIS_MAX_ROOTS];
+    int nr_pids;
+    int max_depth;              // -1 for the whole subtree
+    bool threads;
+    bool filter_uid;
+    kuid_t uid;
+    size_t comm_len;
+    char comm[TASK_COMM_LEN];   // name prefix
+    bool stats;
+    bool delta;
+};
+
+static DEFINE_SPINLOCK(default_lock);
+static struct psvis_query default_query = {
+    .pids = { 1 }, // default to PID to 1
+    .nr_pids = 1,
+    .max_depth = -1,
+};
 static struct proc_dir_entry *proc_file;
+static struct proc_dir_entry *records_file;
+
+/*
+ * The tree is streamed through seq_operations: position 0 is the graph
+ * header, positions 1..N are the nodes in pre-order (an edge line plus a
+ * node line each) and N + 1 is the closing brace. The walk is iterative,
+ * so neither stack nor buffer grow with the tree, and seq_file only ever
+ * asks for the next record instead of re-running the whole walk when its
+ * buffer fills up.
+ *
+ * The children and sibling lists and real_parent only hold still under
+ * tasklist_lock, so start() read-locks it and stop() lets it go again,
+ * one seq_file buffer at a time. Across reads the iterator keeps a
+ * reference to the task it stopped at and resumes from it when it is
+ * still alive and still depth levels below its root, otherwise it walks
+ * again from the root up to the requested position. Trees that change
+ * between reads come out as a best-effort snapshot.
+ *
+ * /proc/psvis_records walks the same way but writes each node as a
+ * struct psvis_record and nothing for the header and footer positions.
+ */
+enum psvis_state {
+    PSVIS_HEADER,
+    PSVIS_NODE,
+    PSVIS_FOOTER,
+    PSVIS_DONE,
+};
+
+struct psvis_stats {
+    u64 utime;                  // ns
+    u64 stime;
+    unsigned long rss;          // KiB
+    int threads;
+    char state;
+};
+
+// what a reader sees of a task, compared between reads in delta mode
+struct psvis_node {
+    pid_t parent;
+    u64 start_time;
+    char comm[TASK_COMM_LEN];
+    struct psvis_stats st;      // zero unless the query asks for stats
+};
+
+// a node reported by an earlier pass over the tree, delta mode only
+struct psvis_seen {
+    struct hlist_node link;
+    pid_t pid;
+    u32 pass;                   // last pass that saw it
+    u32 change;                 // what that pass reported
+    struct psvis_node node;
+};
+
+#define PSVIS_SEEN_BITS 12
+
+// what a rendered output is cached under
+struct psvis_key {
+    struct psvis_query q;
+    struct pid_namespace *ns;   // the query pids were looked up in
+    bool records;               // /proc/psvis_records rather than the DOT file
+};
+
+// a piece of a rendered output, at offset start of the whole
+struct psvis_chunk {
+    loff_t start;
+    size_t len;
+    char *data;                 // PSVIS_CHUNK_SIZE bytes
+};
+
+// the whole output of one query, shared by the readers of that query
+struct psvis_render {
+    struct kref ref;
+    struct psvis_key key;
+    u64 gen;                    // psvis_generation before the walk
+    bool unsettled;             // may change with no bump, not cached
+    size_t size;
+    int nr_chunks;
+    struct psvis_chunk *chunks;
+};
+
+struct psvis_iter {
+    struct psvis_query q;
+    struct psvis_render *render; // served instead of walking, if cacheable
+    struct hlist_head *seen;    // PSVIS_SEEN_BITS buckets, in delta mode
+    u32 pass;                   // complete reads of the tree so far
+    struct task_struct *roots[PSVIS_MAX_ROOTS]; // referenced until the
+                                // query changes, NULL if gone or covered
+    bool found;                 // roots were looked up
+    int r;                      // index of the root being walked
+    struct task_struct *task;   // current node
+    struct task_struct *held;   // task, referenced between reads
+    enum psvis_state state;
+    int depth;                  // of task below its root
+    loff_t pos;                 // position of the current record
+    bool unsettled;             // passed a task between its exit and
+                                // exit_notify(), see psvis_render_fill()
+};
+
+static bool psvis_match(const struct psvis_query *q, struct task_struct *task) {
+    if (q->filter_uid && !uid_eq(task_uid(task), q->uid))
+        return false;
+    return strncmp(task->comm, q->comm, q->comm_len) == 0;
+}
+
+// a root walked before the current one, whose subtree is out already
+static bool psvis_walked_root(struct psvis_iter *it, struct task_struct *task) {
+    int i;
+
+    for (i = 0; i < it->r; i++) {
+        if (it->roots[i] == task)
+            return true;
+    }
+    return false;
+}
+
+// exiting but its children not handed on yet, nor itself made a zombie
+static void psvis_note_exiting(struct psvis_iter *it,
+                               struct task_struct *task) {
+    if ((task->flags & PF_EXITING) && !READ_ONCE(task->exit_state))
+        it->unsettled = true;
+}
+
+// first task from pos on in a children list that passes the filters
+static struct task_struct *psvis_first_match(struct psvis_iter *it,
+                                             struct list_head *pos,
+                                             struct list_head *head) {
+    struct task_struct *task;
+
+    for (; pos != head; pos = pos->next) {
+        task = list_entry(pos, struct task_struct, sibling);
+        psvis_note_exiting(it, task);
+        if (psvis_match(&it->q, task) && !psvis_walked_root(it, task))
+            return task;
+    }
+    return NULL;
+}
+
+// next thread of leader's group after pos that passes the filters
+static struct task_struct *psvis_next_thread(struct psvis_iter *it,
+                                             struct task_struct *leader,
+                                             struct list_head *pos) {
+    struct list_head *head = &leader->signal->thread_head;
+    struct task_struct *task;
+
+    for (pos = rcu_dereference(list_next_rcu(pos)); pos != head;
+         pos = rcu_dereference(list_next_rcu(pos))) {
+        task = list_entry(pos, struct task_struct, thread_node);
+        if (task != leader && psvis_match(&it->q, task))
+            return task;
+    }
+    return NULL;
+}
+
+// pre-order successor of task within its root's subtree, NULL at the end
+static struct task_struct *psvis_next_task(struct psvis_iter *it,
+                                           struct task_struct *task) {
+    struct task_struct *parent, *next;
+
+    if (it->depth > 0 && !thread_group_leader(task)) {
+        // a thread is a leaf, then come its leader's children
+        next = psvis_next_thread(it, task->group_leader, &task->thread_node);
+        if (next)
+            return next;
+        task = task->group_leader;
+        it->depth--;
+    } else if (it->q.threads && thread_group_leader(task) &&
+               it->depth != it->q.max_depth) {
+        next = psvis_next_thread(it, task, &task->signal->thread_head);
+        if (next) {
+            it->depth++;
+            return next;
+        }
+    }
+
+    if (it->depth != it->q.max_depth) {
+        next = psvis_first_match(it, task->children.next, &task->children);
+        if (next) {
+            it->depth++;
+            return next;
+        }
+    }
+    while (it->depth > 0) {
+        parent = rcu_dereference(task->real_parent);
+        next = psvis_first_match(it, task->sibling.next, &parent->children);
+        if (next)
+            return next;
+        task = parent;
+        it->depth--;
+    }
+    return NULL;
+}
+
+// the node a task hangs from in the output
+static struct task_struct *psvis_parent(struct psvis_iter *it,
+                                        struct task_struct *task) {
+    if (it->depth > 0 && !thread_group_leader(task))
+        return task->group_leader;
+    return rcu_dereference(task->real_parent);
+}
+
+static void psvis_drop_held(struct psvis_iter *it) {
+    if (it->held) {
+        put_task_struct(it->held);
+        it->held = NULL;
+    }
+}
+
+// drop the nodes the current pass did not see, after reporting them
+static void psvis_forget_exited(struct psvis_iter *it, bool all) {
+    struct psvis_seen *seen;
+    struct hlist_node *tmp;
+    int i;
+
+    for (i = 0; it->seen && i < (1 << PSVIS_SEEN_BITS); i++) {
+        hlist_for_each_entry_safe(seen, tmp, &it->seen[i], link) {
+            if (all || seen->pass != it->pass) {
+                hlist_del(&seen->link);
+                kfree(seen);
+            }
+        }
+    }
+}
+
+static void psvis_render_free(struct kref *ref) {
+    struct psvis_render *r = container_of(ref, struct psvis_render, ref);
+    int i;
+
+    for (i = 0; i < r->nr_chunks; i++)
+        kvfree(r->chunks[i].data);
+    kfree(r->chunks);
+    kfree(r);
+}
+
+static void psvis_render_put(struct psvis_render *r) {
+    if (r)
+        kref_put(&r->ref, psvis_render_free);
+}
+
+// forget the walk and the root, the next read starts a new query
+static void psvis_reset(struct psvis_iter *it) {
+    int i;
+
+    psvis_render_put(it->render);
+    it->render = NULL;
+    psvis_forget_exited(it, true);
+    kvfree(it->seen);
+    it->seen = NULL;
+    it->pass = 0;
+    psvis_drop_held(it);
+    for (i = 0; i < PSVIS_MAX_ROOTS; i++) {
+        if (it->roots[i])
+            put_task_struct(it->roots[i]);
+        it->roots[i] = NULL;
+    }
+    it->found = false;
+    it->unsettled = false;
+    it->task = NULL;
+    it->state = PSVIS_HEADER;
+    it->pos = 0;
+}
+
+// the next root from index r on, NULL after the last
+static struct task_struct *psvis_next_root(struct psvis_iter *it, int r) {
+    for (it->r = r; it->r < it->q.nr_pids; it->r++) {
+        if (it->roots[it->r])
+            return it->roots[it->r];
+    }
+    return NULL;
+}
+
+static void psvis_advance(struct psvis_iter *it) {
+    struct task_struct *next;
+
+    switch (it->state) {
+    case PSVIS_HEADER:
+        it->task = psvis_next_root(it, 0);
+        it->depth = 0;
+        it->state = PSVIS_NODE;
+        break;
+    case PSVIS_NODE:
+        next = psvis_next_task(it, it->task);
+        if (!next)
+            next = psvis_next_root(it, it->r + 1);
+        psvis_drop_held(it);
+        it->task = next;
+        if (!next)
+            it->state = PSVIS_FOOTER;
+        break;
+    default:
+        // the exited nodes were reported with the footer
+        psvis_forget_exited(it, false);
+        it->pass++;
+        it->state = PSVIS_DONE;
+        break;
+    }
+    it->pos++;
+}
+
+static void psvis_rewind(struct psvis_iter *it, loff_t pos) {
+    psvis_drop_held(it);
+    it->task = NULL;
+    it->state = PSVIS_HEADER;
+    it->pos = 0;
+    while (it->pos < pos && it->state != PSVIS_DONE)
+        psvis_advance(it);
+}
+
+static bool psvis_descends(struct task_struct *task,
+                           struct task_struct *ancestor) {
+    for (; task->pid != 0; task = rcu_dereference(task->real_parent)) {
+        if (task == ancestor)
+            return true;
+    }
+    return false;
+}
 
-void write_process_tree(struct task_struct *task, struct seq_file *m) {
-    struct task_struct *child;
-    struct list_head *list;
+// look the roots up once per query, leaving out the ones already covered
+static bool psvis_find_roots(struct psvis_iter *it) {
+    struct pid *pid_struct;
+    bool any = false;
+    int i, j;
+
+    for (i = 0; i < it->q.nr_pids; i++) {
+        pid_struct = find_get_pid(it->q.pids[i]);
+        it->roots[i] = get_pid_task(pid_struct, PIDTYPE_PID);
+        put_pid(pid_struct);
+        for (j = 0; it->roots[i] && j < i; j++) {
+            if (it->roots[j] && psvis_descends(it->roots[i], it->roots[j])) {
+                put_task_struct(it->roots[i]);
+                it->roots[i] = NULL;
+            }
+        }
+        any = any || it->roots[i];
+    }
+    // with none found, every read looks again and fails with ESRCH
+    it->found = any;
+    return any;
+}
+
+// whether the held task is still depth levels below the root it was under
+static bool psvis_in_place(struct psvis_iter *it) {
+    struct task_struct *task = it->held;
+    int depth;
+
+    if (!pid_alive(task))
+        return false;
+    // a reparent or an exec of the group leader moves the task
+    for (depth = it->depth; depth > 0; depth--) {
+        if (thread_group_leader(task))
+            task = rcu_dereference(task->real_parent);
+        else
+            task = task->group_leader;
+    }
+    return task == it->roots[it->r];
+}
+
+/*
+ * Lock the task lists and move the walk to pos, resuming from the held
+ * task when it has not moved. psvis_walk_end() has to follow either way.
+ */
+static int psvis_walk_begin(struct psvis_iter *it, loff_t pos) {
+    read_lock(&tasklist_lock);
+    rcu_read_lock();
+    // none of the PIDs exist, as for a single one
+    if (!it->found && !psvis_find_roots(it))
+        return -ESRCH;
+    if (pos != it->pos || (it->held && !psvis_in_place(it)))
+        psvis_rewind(it, pos);
+    return 0;
+}
+
+// keep a reference to where the walk stopped and unlock the task lists
+static void psvis_walk_end(struct psvis_iter *it) {
+    if (it->state == PSVIS_NODE && it->task && !it->held) {
+        get_task_struct(it->task);
+        it->held = it->task;
+    }
+    rcu_read_unlock();
+    read_unlock(&tasklist_lock);
+}
+
+static void *psvis_start(struct seq_file *m, loff_t *pos) {
+    struct psvis_iter *it = m->private;
+    int err;
+
+    err = psvis_walk_begin(it, *pos);
+    if (err)
+        return ERR_PTR(err);
+    return it->state == PSVIS_DONE ? NULL : it;
+}
+
+static void *psvis_next(struct seq_file *m, void *v, loff_t *pos) {
+    struct psvis_iter *it = m->private;
+
+    psvis_advance(it);
+    *pos = it->pos;
+    return it->state == PSVIS_DONE ? NULL : it;
+}
+
+static void psvis_stop(struct seq_file *m, void *v) {
+    psvis_walk_end(m->private);
+}
+
+static void psvis_task_stats(struct task_struct *task,
+                             struct psvis_stats *st) {
+    struct task_struct *t;
+    struct mm_struct *mm;
+
+    st->state = task_state_to_char(task);
+    st->threads = get_nr_threads(task);
+    if (thread_group_leader(task)) {
+        // a process counts its threads, live and exited
+        st->utime = task->signal->utime;
+        st->stime = task->signal->stime;
+        for_each_thread(task, t) {
+            st->utime += t->utime;
+            st->stime += t->stime;
+        }
+    } else {
+        st->utime = task->utime;
+        st->stime = task->stime;
+    }
+
+    // the task holds its mm until exit_mm(), which takes this lock
+    task_lock(task);
+    mm = task->mm;
+    st->rss = mm ? get_mm_rss(mm) << (PAGE_SHIFT - 10) : 0;
+    task_unlock(task);
+}
+
+static void psvis_fill_node(struct psvis_iter *it, struct task_struct *task,
+                            struct psvis_node *node) {
+    memset(node, 0, sizeof(*node));
+    node->parent = psvis_parent(it, task)->pid;
+    node->start_time = task->start_time;
+    strscpy(node->comm, task->comm, sizeof(node->comm));
+    if (it->q.stats)
+        psvis_task_stats(task, &node->st);
+}
+
+/*
+ * What to report for a node: PSVIS_CHANGE_NONE outside delta mode, and in
+ * delta mode what changed since the previous pass, NONE meaning nothing.
+ * show() may run more than once for a record when the seq buffer fills
+ * up, so a pass decides once per node and then repeats itself.
+ */
+static u32 psvis_change(struct psvis_iter *it, struct task_struct *task,
+                        const struct psvis_node *node) {
+    struct hlist_head *bucket;
+    struct psvis_seen *seen;
+
+    if (!it->seen)
+        return PSVIS_CHANGE_NONE;
+
+    bucket = &it->seen[hash_32(task->pid, PSVIS_SEEN_BITS)];
+    hlist_for_each_entry(seen, bucket, link) {
+        if (seen->pid == task->pid)
+            break;
+    }
+    if (!seen) {
+        // untracked if this fails, it is then reported as new again
+        seen = kmalloc(sizeof(*seen), GFP_ATOMIC);
+        if (seen) {
+            seen->pid = task->pid;
+            seen->pass = it->pass;
+            seen->change = PSVIS_CHANGE_CREATED;
+            seen->node = *node;
+            hlist_add_head(&seen->link, bucket);
+        }
+        return PSVIS_CHANGE_CREATED;
+    }
+    if (seen->pass != it->pass) {
+        if (seen->node.start_time != node->start_time)
+            seen->change = PSVIS_CHANGE_CREATED; // the pid was reused
+        else if (memcmp(&seen->node, node, sizeof(*node)))
+            seen->change = PSVIS_CHANGE_CHANGED;
+        else
+            seen->change = PSVIS_CHANGE_NONE;
+        seen->node = *node;
+        seen->pass = it->pass;
+    }
+    return seen->change;
+}
+
+static const char *const psvis_change_names[] = {
+    "none", "created", "changed", "exited",
+};
+
+/*
+ * Longest output of one position but the delta footer: an edge and a node
+ * line with every attribute, with room to spare.
+ */
+#define PSVIS_LINE_MAX 384
+
+static size_t psvis_format_attrs(struct psvis_iter *it,
+                                 const struct psvis_node *node, u32 change,
+                                 char *buf, size_t size) {
+    const struct psvis_stats *st = &node->st;
+    size_t len;
+
+    if (!it->q.stats && !it->seen)
+        return 0;
+    len = scnprintf(buf, size, " [");
+    if (it->q.stats)
+        len += scnprintf(buf + len, size - len,
+                         "state=\"%c\" utime=%llu stime=%llu rss=%lu "
+                         "threads=%d start=%llu%s", st->state, st->utime,
+                         st->stime, st->rss, st->threads, node->start_time,
+                         it->seen ? " " : "");
+    if (it->seen)
+        len += scnprintf(buf + len, size - len, "delta=%s",
+                         psvis_change_names[change]);
+    len += scnprintf(buf + len, size - len, "]");
+    return len;
+}
+
+static void psvis_fill_record(struct psvis_iter *it, struct psvis_record *rec,
+                              u32 change) {
+    memset(rec, 0, sizeof(*rec));
+    rec->version = PSVIS_RECORD_VERSION;
+    rec->size = it->q.stats || it->seen ? sizeof(*rec) : PSVIS_RECORD_V1_SIZE;
+    rec->change = change;
+}
+
+static size_t psvis_format_node(struct psvis_iter *it, char *buf) {
+    struct task_struct *task = it->task;
+    struct psvis_node node;
+    size_t len = 0;
+    u32 change;
+
+    psvis_fill_node(it, task, &node);
+    change = psvis_change(it, task, &node);
+    if (it->seen && change == PSVIS_CHANGE_NONE)
+        return 0;
+    if (it->depth > 0) {
+        len = scnprintf(buf, PSVIS_LINE_MAX, "\"%d\\n%s\" -> \"%d\\n%s\";\n",
+                        node.parent, psvis_parent(it, task)->comm, task->pid,
+                        node.comm);
+    }
+    len += scnprintf(buf + len, PSVIS_LINE_MAX - len, "\"%d\\n%s\"",
+                     task->pid, node.comm);
+    len += psvis_format_attrs(it, &node, change, buf + len,
+                              PSVIS_LINE_MAX - len);
+    len += scnprintf(buf + len, PSVIS_LINE_MAX - len, ";\n");
+    return len;
+}
+
+static size_t psvis_format_record(struct psvis_iter *it, char *buf) {
+    struct task_struct *task = it->task;
+    struct psvis_record rec;
+    struct psvis_node node;
+    u32 change;
+
+    psvis_fill_node(it, task, &node);
+    change = psvis_change(it, task, &node);
+    if (it->seen && change == PSVIS_CHANGE_NONE)
+        return 0;
+
+    psvis_fill_record(it, &rec, change);
+    rec.depth = it->depth;
+    rec.pid = task->pid;
+    rec.ppid = rcu_dereference(task->real_parent)->tgid;
+    rec.tgid = task->tgid;
+    memcpy(rec.comm, node.comm, sizeof(rec.comm));
+    rec.state = node.st.state;
+    rec.threads = node.st.threads;
+    rec.utime_ns = node.st.utime;
+    rec.stime_ns = node.st.stime;
+    rec.rss_kb = node.st.rss;
+    rec.start_time_ns = it->q.stats ? node.start_time : 0;
+    memcpy(buf, &rec, rec.size);
+    return rec.size;
+}
+
+// the output of the current position into PSVIS_LINE_MAX bytes at buf
+static size_t psvis_format(struct psvis_iter *it, bool records, char *buf) {
+    switch (it->state) {
+    case PSVIS_HEADER:
+        return records ? 0 : scnprintf(buf, PSVIS_LINE_MAX,
+                                       "digraph ProcessTree {\n");
+    case PSVIS_NODE:
+        return records ? psvis_format_record(it, buf)
+                       : psvis_format_node(it, buf);
+    case PSVIS_FOOTER:
+        return records ? 0 : scnprintf(buf, PSVIS_LINE_MAX, "}\n");
+    default:
+        return 0;
+    }
+}
+
+// the nodes this pass did not see again, before the footer in delta mode
+static void psvis_show_exited(struct seq_file *m, struct psvis_iter *it,
+                              bool records) {
+    struct psvis_record rec;
+    struct psvis_seen *seen;
+    int i;
+
+    for (i = 0; it->seen && i < (1 << PSVIS_SEEN_BITS); i++) {
+        hlist_for_each_entry(seen, &it->seen[i], link) {
+            if (seen->pass == it->pass)
+                continue;
+            if (!records) {
+                seq_printf(m, "\"%d\\n%s\" [delta=exited];\n", seen->pid,
+                           seen->node.comm);
+                continue;
+            }
+            psvis_fill_record(it, &rec, PSVIS_CHANGE_EXITED);
+            rec.pid = seen->pid;
+            memcpy(rec.comm, seen->node.comm, sizeof(rec.comm));
+            seq_write(m, &rec, rec.size);
+        }
+    }
+}
+
+static int psvis_show_pos(struct seq_file *m, struct psvis_iter *it,
+                          bool records) {
+    char buf[PSVIS_LINE_MAX];
+
+    if (it->state == PSVIS_FOOTER)
+        psvis_show_exited(m, it, records);
+    seq_write(m, buf, psvis_format(it, records, buf));
+    return 0;
+}
+
+static int psvis_show(struct seq_file *m, void *v) {
+    return psvis_show_pos(m, v, false);
+}
+
+static int psvis_show_record(struct seq_file *m, void *v) {
+    return psvis_show_pos(m, v, true);
+}
+
+static const struct seq_operations psvis_seq_ops = {
+    .start = psvis_start,
+    .next = psvis_next,
+    .stop = psvis_stop,
+    .show = psvis_show,
+};
+
+static const struct seq_operations psvis_record_ops = {
+    .start = psvis_start,
+    .next = psvis_next,
+    .stop = psvis_stop,
+    .show = psvis_show_record,
+};
+
+/*
+ * Rendered output cache. Without stats or delta, the output of a query
+ * only changes when a task forks, execs or exits, and the tracepoint
+ * probes below bump psvis_generation on each of those. An exit changes
+ * the tree in three steps: sched_process_exit fires, exit_notify() then
+ * hands the children to a reaper and leaves a zombie, and release_task()
+ * unlinks the zombie once reaped, with sched_process_free after it. Both
+ * tracepoints bump the generation, and a render that saw a task between
+ * the first two steps is not cached, as nothing bumps the generation
+ * after exit_notify(). A read from offset
+ * 0 looks its query up in a small cache and, if the entry was rendered at
+ * the current generation, shares it by reference instead of walking the
+ * tasks again; otherwise it renders the whole output once and replaces
+ * the entry. The rest of the read, and every read after it that does not
+ * start at 0, is served from the same render.
+ *
+ * A render is one walk written into PSVIS_CHUNK_SIZE chunks. The task
+ * lists are locked for one chunk at a time, as for a seq_file buffer, and
+ * the next chunk is allocated with them unlocked.
+ *
+ * A rename through prctl() or a change of uid does not bump the
+ * generation, so a cached tree can show an old name or uid filter result
+ * until the next fork, exec or exit. Each slot has a mutex held while its
+ * query is rendered, so concurrent readers of the same query wait for one
+ * walk rather than all doing it, and other queries and hits go on.
+ * Without the tracepoints there is no generation to trust and every read
+ * walks the tasks.
+ */
+#define PSVIS_CACHE_NAME "psvis_cache"
+#define PSVIS_CACHE_SLOTS 8
+#define PSVIS_CHUNK_SIZE (64 * 1024)
+
+struct psvis_slot {
+    struct mutex render_lock;   // held while this slot's query is rendered
+    struct psvis_render *render;
+    u64 used;                   // cache clock at the last hit
+};
+
+static atomic64_t psvis_generation = ATOMIC64_INIT(0);
+static bool psvis_cache_enabled;    // the probes are registered
+// the render and used of every slot, and the counters below
+static DEFINE_SPINLOCK(psvis_cache_lock);
+static struct psvis_slot psvis_cache[PSVIS_CACHE_SLOTS];
+static u64 psvis_cache_clock;
+static u64 psvis_cache_hits;
+static u64 psvis_cache_misses;
+static struct proc_dir_entry *cache_file;
+
+static bool psvis_cacheable(const struct psvis_query *q) {
+    return psvis_cache_enabled && !q->stats && !q->delta;
+}
 
-    seq_printf(m, "\"%d\\n%s\";\n", task->pid, task->comm);
+// a new empty chunk at the end of r, NULL if out of memory
+static struct psvis_chunk *psvis_render_grow(struct psvis_render *r) {
+    struct psvis_chunk *chunks, *c;
+    char *data;
 
-    list_for_each(list, &task->children) {
-        child = list_entry(list, struct task_struct, sibling);
-        seq_printf(m, "\"%d\\n%s\" -> \"%d\\n%s\";\n",
-                   task->pid, task->comm, child->pid, child->comm);
-        write_process_tree(child, m);
+    data = kvmalloc(PSVIS_CHUNK_SIZE, GFP_KERNEL);
+    if (!data)
+        return NULL;
+    chunks = krealloc(r->chunks, (r->nr_chunks + 1) * sizeof(*chunks),
+                      GFP_KERNEL);
+    if (!chunks) {
+        kvfree(data);
+        return NULL;
     }
+    r->chunks = chunks;
+    c = &chunks[r->nr_chunks++];
+    c->start = r->size;
+    c->len = 0;
+    c->data = data;
+    return c;
 }
+
+// walk the query of r once, filling chunks until the output ends
+static int psvis_render_fill(struct psvis_render *r) {
+    struct psvis_iter it = { .q = r->key.q };
+    struct psvis_chunk *c;
+    int err;
+
+    do {
+        c = psvis_render_grow(r);
+        if (!c) {
+            err = -ENOMEM;
+            break;
+        }
+        err = psvis_walk_begin(&it, it.pos);
+        while (!err && it.state != PSVIS_DONE &&
+               PSVIS_CHUNK_SIZE - c->len >= PSVIS_LINE_MAX) {
+            if (it.state == PSVIS_NODE)
+                psvis_note_exiting(&it, it.task);
+            c->len += psvis_format(&it, r->key.records, c->data + c->len);
+            psvis_advance(&it);
+        }
+        psvis_walk_end(&it);
+        r->size += c->len;
+    } while (!err && it.state != PSVIS_DONE);
+    r->unsettled = it.unsettled;
+    psvis_reset(&it);
+    return err;
+}
+
+// field by field, the padding of a copied query is not defined
+static bool psvis_query_eq(const struct psvis_query *a,
+                           const struct psvis_query *b) {
+    return a->nr_pids == b->nr_pids &&
+           !memcmp(a->pids, b->pids, a->nr_pids * sizeof(a->pids[0])) &&
+           a->max_depth == b->max_depth && a->threads == b->threads &&
+           a->filter_uid == b->filter_uid &&
+           (!a->filter_uid || uid_eq(a->uid, b->uid)) &&
+           a->comm_len == b->comm_len &&
+           !memcmp(a->comm, b->comm, a->comm_len) &&
+           a->stats == b->stats && a->delta == b->delta;
+}
+
+static bool psvis_key_eq(const struct psvis_key *a, const struct psvis_key *b) {
+    return a->ns == b->ns && a->records == b->records &&
+           psvis_query_eq(&a->q, &b->q);
+}
+
+static bool psvis_cache_fresh(struct psvis_render *r,
+                              const struct psvis_key *key) {
+    return r && psvis_key_eq(&r->key, key) &&
+           r->gen == atomic64_read(&psvis_generation);
+}
+
+// the slot holding key, or else the one to render it into
+static struct psvis_slot *psvis_cache_slot(const struct psvis_key *key) {
+    struct psvis_slot *slot, *victim = NULL;
+
+    for (slot = psvis_cache; slot < psvis_cache + PSVIS_CACHE_SLOTS; slot++) {
+        if (!slot->render) {
+            if (!victim || victim->render)
+                victim = slot;
+            continue;
+        }
+        if (psvis_key_eq(&slot->render->key, key))
+            return slot;
+        if (!victim || (victim->render && slot->used < victim->used))
+            victim = slot;
+    }
+    return victim;
+}
+
+// take a reference to the render of slot if it is key's and up to date
+static struct psvis_render *psvis_cache_hit(struct psvis_slot *slot,
+                                            const struct psvis_key *key) {
+    struct psvis_render *r = slot->render;
+
+    if (!psvis_cache_fresh(r, key))
+        return NULL;
+    slot->used = ++psvis_cache_clock;
+    psvis_cache_hits++;
+    kref_get(&r->ref);
+    return r;
+}
+
+// the cached output for the query of it, rendered again if out of date
+static struct psvis_render *psvis_cache_get(struct psvis_iter *it,
+                                            bool records) {
+    struct psvis_render *r, *old;
+    struct psvis_slot *slot;
+    struct psvis_key key;
+    int err;
+
+    key.q = it->q;
+    key.ns = task_active_pid_ns(current);
+    key.records = records;
+
+    spin_lock(&psvis_cache_lock);
+    slot = psvis_cache_slot(&key);
+    r = psvis_cache_hit(slot, &key);
+    spin_unlock(&psvis_cache_lock);
+    if (r)
+        return r;
+
+    // whoever holds the slot may be rendering this very query
+    mutex_lock(&slot->render_lock);
+    spin_lock(&psvis_cache_lock);
+    r = psvis_cache_hit(slot, &key);
+    if (!r)
+        psvis_cache_misses++;
+    spin_unlock(&psvis_cache_lock);
+    if (r)
+        goto out;
+
+    r = kzalloc(sizeof(*r), GFP_KERNEL);
+    if (!r) {
+        r = ERR_PTR(-ENOMEM);
+        goto out;
+    }
+    kref_init(&r->ref);
+    r->key = key;
+    r->gen = atomic64_read(&psvis_generation);
+    err = psvis_render_fill(r);
+    if (err) {
+        psvis_render_put(r);
+        r = ERR_PTR(err);
+        goto out;
+    }
+    if (r->unsettled)
+        goto out;
+
+    kref_get(&r->ref);
+    spin_lock(&psvis_cache_lock);
+    old = slot->render;
+    slot->render = r;
+    slot->used = ++psvis_cache_clock;
+    spin_unlock(&psvis_cache_lock);
+    psvis_render_put(old);
+out:
+    mutex_unlock(&slot->render_lock);
+    return r;
+}
+
+// copy the render from ki_pos on, across as many chunks as fit
+static ssize_t psvis_render_read(struct psvis_render *r, struct kiocb *iocb,
+                                 struct iov_iter *to) {
+    struct psvis_chunk *c;
+    size_t off, n;
+    ssize_t done = 0;
+    int i;
+
+    for (i = 0; i < r->nr_chunks && iov_iter_count(to); i++) {
+        c = &r->chunks[i];
+        if (iocb->ki_pos >= c->start + c->len)
+            continue;
+        off = iocb->ki_pos - c->start;
+        n = copy_to_iter(c->data + off, c->len - off, to);
+        if (!n)
+            return done ? done : -EFAULT;
+        iocb->ki_pos += n;
+        done += n;
+        if (n < c->len - off)
+            break;
+    }
+    return done;
+}
+
+static ssize_t psvis_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct seq_file *m = iocb->ki_filp->private_data;
+    struct psvis_iter *it = m->private;
+    struct psvis_render *r;
+    ssize_t ret;
+
+    if (!psvis_cacheable(&it->q))
+        return seq_read_iter(iocb, to);
+
+    mutex_lock(&m->lock);
+    // reading from the start again picks up a changed tree
+    if (iocb->ki_pos == 0 || !it->render) {
+        r = psvis_cache_get(it, m->op == &psvis_record_ops);
+        if (IS_ERR(r)) {
+            ret = PTR_ERR(r);
+            goto out;
+        }
+        psvis_render_put(it->render);
+        it->render = r;
+    }
+    ret = psvis_render_read(it->render, iocb, to);
+out:
+    mutex_unlock(&m->lock);
+    return ret;
+}
+
+static loff_t psvis_lseek(struct file *file, loff_t offset, int whence) {
+    struct seq_file *m = file->private_data;
+    struct psvis_iter *it = m->private;
+
+    if (psvis_cacheable(&it->q))
+        return no_seek_end_llseek(file, offset, whence);
+    return seq_lseek(file, offset, whence);
+}
+
+static int psvis_cache_show(struct seq_file *m, void *v) {
+    int i, entries = 0;
+    size_t bytes = 0;
+
+    spin_lock(&psvis_cache_lock);
+    for (i = 0; i < PSVIS_CACHE_SLOTS; i++) {
+        if (psvis_cache[i].render) {
+            entries++;
+            bytes += psvis_cache[i].render->size;
+        }
+    }
+    seq_printf(m, "enabled %d\nhits %llu\nmisses %llu\n",
+               psvis_cache_enabled, psvis_cache_hits, psvis_cache_misses);
+    seq_printf(m, "entries %d\nbytes %zu\ngeneration %lld\n", entries, bytes,
+               (long long)atomic64_read(&psvis_generation));
+    spin_unlock(&psvis_cache_lock);
+    return 0;
+}
+
+static void psvis_cache_init(void) {
+    int i;
+
+    for (i = 0; i < PSVIS_CACHE_SLOTS; i++)
+        mutex_init(&psvis_cache[i].render_lock);
+}
+
+static void psvis_cache_clear(void) {
+    int i;
+
+    for (i = 0; i < PSVIS_CACHE_SLOTS; i++) {
+        psvis_render_put(psvis_cache[i].render);
+        psvis_cache[i].render = NULL;
+    }
+}
+
+static int psvis_parse_pids(char *token, struct psvis_query *q) {
+    char *pid;
+
+    while ((pid = strsep(&token, ",")) != NULL) {
+        if (q->nr_pids == PSVIS_MAX_ROOTS)
+            return -EINVAL;
+        if (kstrtoint(pid, 10, &q->pids[q->nr_pids]) ||
+            q->pids[q->nr_pids] < 0)
+            return -EINVAL;
+        q->nr_pids++;
+    }
+    return 0;
+}
+
+static int psvis_parse_query(char *buf, struct psvis_query *q) {
+    char *token;
+    unsigned int uid;
+    bool has_pid = false;
+
+    memset(q, 0, sizeof(*q));
+    q->max_depth = -1;
+    while ((token = strsep(&buf, " \t\n")) != NULL) {
+        if (!*token)
+            continue;
+        if (!has_pid) {
+            if (psvis_parse_pids(token, q))
+                return -EINVAL;
+            has_pid = true;
+        } else if (strncmp(token, "depth=", 6) == 0) {
+            if (kstrtoint(token + 6, 10, &q->max_depth) || q->max_depth < 0)
+                return -EINVAL;
+        } else if (strcmp(token, "threads") == 0) {
+            q->threads = true;
+        } else if (strncmp(token, "uid=", 4) == 0) {
+            if (kstrtouint(token + 4, 10, &uid))
+                return -EINVAL;
+            q->uid = make_kuid(current_user_ns(), uid);
+            if (!uid_valid(q->uid))
+                return -EINVAL;
+            q->filter_uid = true;
+        } else if (strncmp(token, "comm=", 5) == 0) {
+            strscpy(q->comm, token + 5, sizeof(q->comm));
+            q->comm_len = strlen(q->comm);
+        } else if (strcmp(token, "stats") == 0) {
+            q->stats = true;
+        } else if (strcmp(token, "delta") == 0) {
+            q->delta = true;
+        } else {
+            return -EINVAL;
+        }
+    }
+    return has_pid ? 0 : -EINVAL;
+}
+
 static ssize_t psvis_write(struct file *file, const char __user *buffer, size_t count, loff_t *pos) {
-    char buf[16];
+    struct seq_file *m = file->private_data;
+    struct psvis_iter *it = m->private;
+    struct psvis_query q;
+    struct hlist_head *seen = NULL;
+    char buf[PSVIS_QUERY_MAX];
 
     if (count >= sizeof(buf)) {
         printk(KERN_ERR "psvis_write: Input too large\n");
@@ -44,58 +1114,399 @@ static ssize_t psvis_write(struct file *file, const char __user *buffer, size_t
     }
 
     buf[count] = '\0';
-    strncpy(input_pid, buf, sizeof(input_pid) - 1);
-    input_pid[sizeof(input_pid) - 1] = '\0';
+    if (psvis_parse_query(buf, &q)) {
+        printk(KERN_ERR "psvis_write: Invalid query\n");
+        return -EINVAL;
+    }
 
-    printk(KERN_INFO "psvis_write: Received PID %s\n", input_pid);
-    return count;
-}
+    if (q.delta) {
+        seen = kvcalloc(1 << PSVIS_SEEN_BITS, sizeof(*seen), GFP_KERNEL);
+        if (!seen)
+            return -ENOMEM;
+    }
 
-static int psvis_show(struct seq_file *m, void *v) {
-    struct pid *pid_struct;
-    struct task_struct *task;
+    mutex_lock(&m->lock);
+    it->q = q;
+    psvis_reset(it);
+    it->seen = seen;
+    mutex_unlock(&m->lock);
 
-    int pid = simple_strtol(input_pid, NULL, 10);
-    pid_struct = find_get_pid(pid);
-    if (!pid_struct) {
-        seq_printf(m, "PID %d not found.\n", pid);
-        return -EINVAL;
+    if (!(file->f_mode & FMODE_READ)) {
+        spin_lock(&default_lock);
+        default_query = q;
+        spin_unlock(&default_lock);
     }
 
-    task = pid_task(pid_struct, PIDTYPE_PID);
-    if (!task) {
-        seq_printf(m, "PID %d not found.\n", pid);
-        return -EINVAL;
-    }
+    printk(KERN_DEBUG "psvis_write: Received %d PIDs, the first %d\n",
+           q.nr_pids, q.pids[0]);
+    return count;
+}
 
-    seq_puts(m, "digraph ProcessTree {\n");
-    write_process_tree(task, m);
-    seq_puts(m, "}\n");
+static int psvis_open_ops(struct inode *inode, struct file *file,
+                          const struct seq_operations *ops) {
+    struct psvis_iter *it;
+
+    it = __seq_open_private(file, ops, sizeof(*it));
+    if (!it)
+        return -ENOMEM;
 
+    spin_lock(&default_lock);
+    it->q = default_query;
+    spin_unlock(&default_lock);
     return 0;
 }
+
 static int psvis_open(struct inode *inode, struct file *file) {
-    return single_open(file, psvis_show, NULL);
+    return psvis_open_ops(inode, file, &psvis_seq_ops);
+}
+
+static int psvis_records_open(struct inode *inode, struct file *file) {
+    return psvis_open_ops(inode, file, &psvis_record_ops);
+}
+
+static int psvis_release(struct inode *inode, struct file *file) {
+    struct psvis_iter *it = ((struct seq_file *)file->private_data)->private;
+
+    psvis_reset(it);
+    return seq_release_private(inode, file);
 }
 
 static const struct proc_ops proc_file_ops = {
     .proc_open = psvis_open,
-    .proc_read = seq_read,
+    .proc_read_iter = psvis_read_iter,
+    .proc_write = psvis_write,
+    .proc_lseek = psvis_lseek,
+    .proc_release = psvis_release,
+};
+
+static const struct proc_ops records_file_ops = {
+    .proc_open = psvis_records_open,
+    .proc_read_iter = psvis_read_iter,
     .proc_write = psvis_write,
-    .proc_lseek = seq_lseek,
-    .proc_release = single_release,
+    .proc_lseek = psvis_lseek,
+    .proc_release = psvis_release,
 };
+
+/*
+ * /proc/psvis_events. Each open file is a reader with its own ring of
+ * events, and the fork, exec and exit tracepoints append to the ring of
+ * every reader on psvis_readers. The probes only take the reader's
+ * spinlock for the copy into its ring, so a slow reader never holds up
+ * the others or the task being traced. When a ring is full the event is
+ * dropped and counted, and the first event that fits again is preceded by
+ * a PSVIS_EVENT_OVERFLOW event with the count, so readers know to take a
+ * new snapshot instead of silently going out of sync.
+ *
+ * The events are those of the whole host with pids as the init namespace
+ * sees them, so only root may open the file, and only with CAP_SYS_ADMIN.
+ */
+#define PSVIS_EVENT_RING 4096   // events per reader, a power of two
+#define PSVIS_EVENT_BATCH 8     // events copied to user space at a time
+
+struct psvis_reader {
+    struct list_head link;      // in psvis_readers
+    spinlock_t lock;            // everything below
+    wait_queue_head_t wait;
+    struct psvis_event *ring;
+    u32 head;                   // free running, head - tail are queued
+    u32 tail;
+    u64 seq;                    // of the next event
+    u64 lost;                   // dropped since the last overflow event
+    u64 lost_seq;               // of the first of them
+};
+
+static LIST_HEAD(psvis_readers);
+static DEFINE_SPINLOCK(readers_lock); // writers of psvis_readers
+static struct proc_dir_entry *events_file;
+
+static struct tracepoint *tp_fork;
+static struct tracepoint *tp_exec;
+static struct tracepoint *tp_exit;
+static struct tracepoint *tp_free;
+
+static void psvis_overflow_event(struct psvis_reader *r,
+                                 struct psvis_event *ev) {
+    memset(ev, 0, sizeof(*ev));
+    ev->version = PSVIS_EVENT_VERSION;
+    ev->size = sizeof(*ev);
+    ev->type = PSVIS_EVENT_OVERFLOW;
+    ev->seq = r->lost_seq;
+    ev->time_ns = ktime_get_ns();
+    ev->lost = min_t(u64, r->lost, U32_MAX);
+    r->lost = 0;
+}
+
+// called with r->lock held
+static void psvis_push(struct psvis_reader *r, struct psvis_event *ev) {
+    u32 used = r->head - r->tail;
+
+    ev->seq = r->seq++;
+    if (r->lost && used + 2 <= PSVIS_EVENT_RING) {
+        psvis_overflow_event(r, &r->ring[r->head++ & (PSVIS_EVENT_RING - 1)]);
+        used++;
+    }
+    if (r->lost || used == PSVIS_EVENT_RING) {
+        if (!r->lost++)
+            r->lost_seq = ev->seq;
+        return;
+    }
+    r->ring[r->head++ & (PSVIS_EVENT_RING - 1)] = *ev;
+}
+
+static void psvis_emit(u32 type, struct task_struct *task, pid_t ppid) {
+    struct psvis_reader *r;
+    struct psvis_event ev;
+    unsigned long flags;
+
+    atomic64_inc(&psvis_generation);
+    if (list_empty(&psvis_readers))
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.version = PSVIS_EVENT_VERSION;
+    ev.size = sizeof(ev);
+    ev.type = type;
+    ev.time_ns = ktime_get_ns();
+    ev.pid = task->pid;
+    ev.tgid = task->tgid;
+    ev.ppid = ppid;
+    strscpy(ev.comm, task->comm, sizeof(ev.comm));
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(r, &psvis_readers, link) {
+        spin_lock_irqsave(&r->lock, flags);
+        psvis_push(r, &ev);
+        spin_unlock_irqrestore(&r->lock, flags);
+        if (wq_has_sleeper(&r->wait))
+            wake_up_interruptible(&r->wait);
+    }
+    rcu_read_unlock();
+}
+
+static pid_t psvis_ppid(struct task_struct *task) {
+    pid_t ppid;
+
+    rcu_read_lock();
+    ppid = rcu_dereference(task->real_parent)->tgid;
+    rcu_read_unlock();
+    return ppid;
+}
+
+static void psvis_probe_fork(void *data, struct task_struct *parent,
+                             struct task_struct *child) {
+    psvis_emit(PSVIS_EVENT_FORK, child, parent->tgid);
+}
+
+static void psvis_probe_exec(void *data, struct task_struct *task,
+                             pid_t old_pid, struct linux_binprm *bprm) {
+    psvis_emit(PSVIS_EVENT_EXEC, task, psvis_ppid(task));
+}
+
+// sched_process_exit gained group_dead in 6.16
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 16, 0)
+static void psvis_probe_exit(void *data, struct task_struct *task,
+                             bool group_dead) {
+#else
+static void psvis_probe_exit(void *data, struct task_struct *task) {
+#endif
+    psvis_emit(PSVIS_EVENT_EXIT, task, psvis_ppid(task));
+}
+
+// the task is off its parent's children list, only the cache cares
+static void psvis_probe_free(void *data, struct task_struct *task) {
+    atomic64_inc(&psvis_generation);
+}
+
+// the sched tracepoints are not exported, so look them up by name
+static void psvis_find_tracepoint(struct tracepoint *tp, void *priv) {
+    if (!strcmp(tp->name, "sched_process_fork"))
+        tp_fork = tp;
+    else if (!strcmp(tp->name, "sched_process_exec"))
+        tp_exec = tp;
+    else if (!strcmp(tp->name, "sched_process_exit"))
+        tp_exit = tp;
+    else if (!strcmp(tp->name, "sched_process_free"))
+        tp_free = tp;
+}
+
+static void psvis_unregister_probes(void) {
+    if (tp_fork)
+        tracepoint_probe_unregister(tp_fork, psvis_probe_fork, NULL);
+    if (tp_exec)
+        tracepoint_probe_unregister(tp_exec, psvis_probe_exec, NULL);
+    if (tp_exit)
+        tracepoint_probe_unregister(tp_exit, psvis_probe_exit, NULL);
+    if (tp_free)
+        tracepoint_probe_unregister(tp_free, psvis_probe_free, NULL);
+    tracepoint_synchronize_unregister();
+}
+
+static int psvis_register_probes(void) {
+    int err;
+
+    for_each_kernel_tracepoint(psvis_find_tracepoint, NULL);
+    if (!tp_fork || !tp_exec || !tp_exit || !tp_free)
+        return -ENOENT;
+
+    err = tracepoint_probe_register(tp_fork, psvis_probe_fork, NULL);
+    if (err) {
+        tp_fork = tp_exec = tp_exit = tp_free = NULL;
+        return err;
+    }
+    err = tracepoint_probe_register(tp_exec, psvis_probe_exec, NULL);
+    if (err) {
+        tp_exec = tp_exit = tp_free = NULL;
+        psvis_unregister_probes();
+        return err;
+    }
+    err = tracepoint_probe_register(tp_exit, psvis_probe_exit, NULL);
+    if (err) {
+        tp_exit = tp_free = NULL;
+        psvis_unregister_probes();
+        return err;
+    }
+    err = tracepoint_probe_register(tp_free, psvis_probe_free, NULL);
+    if (err) {
+        tp_free = NULL;
+        psvis_unregister_probes();
+    }
+    return err;
+}
+
+static bool psvis_pending(struct psvis_reader *r) {
+    return READ_ONCE(r->head) != READ_ONCE(r->tail) || READ_ONCE(r->lost);
+}
+
+static ssize_t psvis_events_read(struct file *file, char __user *buffer,
+                                 size_t count, loff_t *pos) {
+    struct psvis_reader *r = file->private_data;
+    struct psvis_event batch[PSVIS_EVENT_BATCH];
+    size_t want = count / sizeof(batch[0]), done = 0;
+    unsigned long flags;
+    size_t n;
+    int err;
+
+    if (!want)
+        return -EINVAL;
+    if (!psvis_pending(r)) {
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        err = wait_event_interruptible(r->wait, psvis_pending(r));
+        if (err)
+            return err;
+    }
+
+    while (done < want) {
+        n = 0;
+        spin_lock_irqsave(&r->lock, flags);
+        while (n < ARRAY_SIZE(batch) && done + n < want) {
+            if (r->tail != r->head)
+                batch[n++] = r->ring[r->tail++ & (PSVIS_EVENT_RING - 1)];
+            else if (r->lost)
+                psvis_overflow_event(r, &batch[n++]);
+            else
+                break;
+        }
+        spin_unlock_irqrestore(&r->lock, flags);
+        if (!n)
+            break;
+
+        // events already taken off the ring are lost if this fails
+        if (copy_to_user(buffer + done * sizeof(batch[0]), batch,
+                         n * sizeof(batch[0])))
+            return done ? done * sizeof(batch[0]) : -EFAULT;
+        done += n;
+    }
+    return done * sizeof(batch[0]);
+}
+
+static __poll_t psvis_events_poll(struct file *file,
+                                  struct poll_table_struct *wait) {
+    struct psvis_reader *r = file->private_data;
+
+    poll_wait(file, &r->wait, wait);
+    return psvis_pending(r) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int psvis_events_open(struct inode *inode, struct file *file) {
+    struct psvis_reader *r;
+
+    // the events cover every task on the host, in every namespace
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+
+    r = kzalloc(sizeof(*r), GFP_KERNEL);
+    if (!r)
+        return -ENOMEM;
+    r->ring = kvcalloc(PSVIS_EVENT_RING, sizeof(*r->ring), GFP_KERNEL);
+    if (!r->ring) {
+        kfree(r);
+        return -ENOMEM;
+    }
+    spin_lock_init(&r->lock);
+    init_waitqueue_head(&r->wait);
+    file->private_data = r;
+
+    spin_lock(&readers_lock);
+    list_add_rcu(&r->link, &psvis_readers);
+    spin_unlock(&readers_lock);
+    return stream_open(inode, file);
+}
+
+static int psvis_events_release(struct inode *inode, struct file *file) {
+    struct psvis_reader *r = file->private_data;
+
+    spin_lock(&readers_lock);
+    list_del_rcu(&r->link);
+    spin_unlock(&readers_lock);
+    synchronize_rcu();
+    kvfree(r->ring);
+    kfree(r);
+    return 0;
+}
+
+static const struct proc_ops events_file_ops = {
+    .proc_open = psvis_events_open,
+    .proc_read = psvis_events_read,
+    .proc_poll = psvis_events_poll,
+    .proc_release = psvis_events_release,
+};
+
 static int __init psvis_init(void) {
+    psvis_cache_init();
     proc_file = proc_create(PROCFS_NAME, 0666, NULL, &proc_file_ops);
     if (!proc_file) {
         return -ENOMEM;
     }
+    records_file = proc_create(PSVIS_RECORDS_NAME, 0666, NULL,
+                               &records_file_ops);
+    if (!records_file) {
+        proc_remove(proc_file);
+        return -ENOMEM;
+    }
+    // the trees work without the events or the cache, so this is not fatal
+    if (psvis_register_probes()) {
+        printk(KERN_WARNING "psvis: no process tracepoints, /proc/%s and the cache disabled\n",
+               PSVIS_EVENTS_NAME);
+    } else {
+        psvis_cache_enabled = true;
+        events_file = proc_create(PSVIS_EVENTS_NAME, 0400, NULL,
+                                  &events_file_ops);
+    }
+    cache_file = proc_create_single(PSVIS_CACHE_NAME, 0444, NULL,
+                                    psvis_cache_show);
     printk(KERN_INFO "psvis module loaded.\n");
     return 0;
 }
 
 static void __exit psvis_exit(void) {
+    proc_remove(cache_file);
+    proc_remove(events_file);
+    proc_remove(records_file);
     proc_remove(proc_file);
+    if (psvis_cache_enabled)
+        psvis_unregister_probes();
+    psvis_cache_clear();
     printk(KERN_INFO "psvis module unloaded.\n");
 }
 
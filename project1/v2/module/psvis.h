@@ -0,0 +1,82 @@
+#ifndef PSVIS_H
+#define PSVIS_H
+
+#include <linux/types.h>
+
+/*
+ * Records read from /proc/psvis_records, shared by the module and its
+ * readers. The subtree of the PID written to the file comes out in
+ * pre-order as an array of fixed-size records, so a reader gets it with
+ * one read() and no parsing. With several PIDs, the subtrees follow each
+ * other and each one starts with a record at depth 0. Fields are only
+ * ever added at the end; readers step by the size field, which lets old
+ * readers skip new fields.
+ */
+
+#define PSVIS_RECORDS_NAME "psvis_records"
+#define PSVIS_RECORD_VERSION 2
+#define PSVIS_RECORD_V1_SIZE 36 // up to comm, all a plain query gets
+#define PSVIS_COMM_LEN 16
+#define PSVIS_MAX_ROOTS 16      // PIDs in one query
+
+// what a record reports in delta mode
+enum psvis_change {
+    PSVIS_CHANGE_NONE,      // full dump, not in delta mode
+    PSVIS_CHANGE_CREATED,   // new since the previous read of the file
+    PSVIS_CHANGE_CHANGED,
+    PSVIS_CHANGE_EXITED,    // gone, only pid and comm are set
+};
+
+struct psvis_record {
+    __u16 version;          // PSVIS_RECORD_VERSION
+    __u16 size;             // bytes in this record
+    __u32 depth;            // 0 for the root
+    __s32 pid;
+    __s32 ppid;             // tgid of the real parent
+    __s32 tgid;
+    char comm[PSVIS_COMM_LEN];
+
+    // version 2, with the stats or delta query options
+    __u32 change;           // enum psvis_change
+    __u8 state;             // as in /proc/<pid>/stat, with stats
+    __u8 pad[3];
+    __u32 threads;          // with stats, as the rest below
+    __u64 utime_ns;         // of all threads for a process
+    __u64 stime_ns;
+    __u64 rss_kb;
+    __u64 start_time_ns;    // since boot
+};
+
+/*
+ * Events read from /proc/psvis_events. Every open file gets its own ring
+ * of them, filled from the fork, exec and exit tracepoints for every task
+ * on the system. read() returns whole events and blocks until there is
+ * one unless the file is non-blocking; poll() reports when there are.
+ * Events that do not fit the ring are dropped and reported by one
+ * PSVIS_EVENT_OVERFLOW event where they would have been.
+ */
+
+#define PSVIS_EVENTS_NAME "psvis_events"
+#define PSVIS_EVENT_VERSION 1
+
+enum psvis_event_type {
+    PSVIS_EVENT_FORK = 1,   // pid and tgid of the child, ppid of the caller
+    PSVIS_EVENT_EXEC,       // comm is the new name
+    PSVIS_EVENT_EXIT,
+    PSVIS_EVENT_OVERFLOW,   // lost events dropped, starting at seq
+};
+
+struct psvis_event {
+    __u16 version;          // PSVIS_EVENT_VERSION
+    __u16 size;
+    __u32 type;             // enum psvis_event_type
+    __u64 seq;              // per file, dropped events are numbered too
+    __u64 time_ns;          // CLOCK_MONOTONIC
+    __s32 pid;
+    __s32 tgid;
+    __s32 ppid;             // tgid of the parent
+    __u32 lost;
+    char comm[PSVIS_COMM_LEN];
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+/**
+ * Allocate zeroed memory from the arena
+ * @param  arena the arena
+ * @param  size  bytes to allocate
+ * @return       the memory, the program exits if out of memory
+ */
+void *arena_alloc(struct arena *arena, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (!arena->chunks || (size_t)(arena->end - arena->ptr) < size) {
+		// chunks double in size so a huge line needs only a few of them
+		size_t chunk_size = arena->chunks ? arena->chunks->size * 2
+										  : ARENA_CHUNK_SIZE;
+		if (chunk_size < size)
+			chunk_size = size;
+
+		struct arena_chunk *chunk =
+			calloc(1, sizeof(struct arena_chunk) + chunk_size + ARENA_ALIGN);
+		if (!chunk) {
+			perror("arena");
+			exit(1);
+		}
+		chunk->size = chunk_size;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->ptr = (char *)(((uintptr_t)chunk->data + ARENA_ALIGN - 1) &
+							  ~(uintptr_t)(ARENA_ALIGN - 1));
+		arena->end = arena->ptr + chunk_size;
+	}
+
+	void *p = arena->ptr;
+	arena->ptr += size;
+	return p;
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t len) {
+	char *p = arena_alloc(arena, len + 1);
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+void arena_free(struct arena *arena) {
+	struct arena_chunk *chunk = arena->chunks, *next;
+	while (chunk) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->chunks = NULL;
+	arena->ptr = arena->end = NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef DASH_ARENA_H
+#define DASH_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE 8192
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	char data[];
+};
+
+// bump allocator, everything is released at once by arena_free()
+struct arena {
+	struct arena_chunk *chunks;
+	char *ptr;
+	char *end;
+};
+
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strndup(struct arena *arena, const char *s, size_t len);
+void arena_free(struct arena *arena);
+
+#endif
@@ -0,0 +1,266 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../module/psvis.h"
+#include "copy.h"
+#include "shell.h"
+#include "stats.h"
+
+bool exit_requested = false;
+
+//module
+/**
+ * Write the process tree the module builds for a query to out_fd
+ * @param  query PIDs separated by commas, then any options
+ * @return 0 on success, 1 on error
+ */
+int psvis_module(const char *query, int out_fd) {
+    // the query belongs to the open file, so write and read through one fd
+    int proc_fd = open("/proc/psvis_tree", O_RDWR | O_CLOEXEC);
+    if (proc_fd < 0) {
+        perror("error opening /proc/psvis_tree");
+        return 1;
+    }
+    if (write(proc_fd, query, strlen(query)) < 0) {
+        perror("error writing the pid to /proc/psvis_tree");
+        close(proc_fd);
+        return 1;
+    }
+
+    // straight from the module's buffer to the output, no stdio copies
+    ssize_t copied = copy_fd(proc_fd, out_fd);
+    if (copied < 0)
+        perror("error reading /proc/psvis_tree");
+    close(proc_fd);
+    return copied < 0;
+}
+
+/**
+ * Write the process trees under several pids, each task only once
+ * @param  pids        numeric pids, at most PSVIS_MAX_ROOTS
+ * @param  nr_pids     number of pids
+ * @param  output_file file to write the graph to, stdout if NULL
+ * @return 0 on success, 1 on error
+ */
+int psvis_command(char *const *pids, int nr_pids, const char *output_file) {
+    pid_t roots[PSVIS_MAX_ROOTS];
+    char query[PSVIS_MAX_ROOTS * 12];
+    int out_fd = STDOUT_FILENO, ret;
+    size_t len = 0;
+
+    // one query for all of them, one walk of each subtree
+    for (int i = 0; i < nr_pids; i++) {
+        roots[i] = atoi(pids[i]);
+        len += snprintf(query + len, sizeof(query) - len, "%s%d",
+                        i ? "," : "", roots[i]);
+    }
+
+    if (output_file) {
+        out_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644);
+        if (out_fd < 0) {
+            perror("error for opening output file for writing");
+            return 1;
+        }
+    } else {
+        fflush(stdout);
+    }
+
+    // without the module, build the same tree from /proc
+    if (access("/proc/psvis_tree", F_OK) == 0)
+        ret = psvis_module(query, out_fd);
+    else
+        ret = psvis_scan(roots, nr_pids, out_fd);
+
+    if (output_file) {
+        close(out_fd);
+        if (ret == 0)
+            printf("Process tree written to %s\n",output_file);
+    }
+    return ret;
+}
+
+int kuhex(const char *file_path, int group_size, FILE *output_stream) {
+    if (group_size != 1 && group_size != 2 && group_size != 4 &&
+        group_size != 8 && group_size != 16) {
+        fprintf(stderr, "invalid group size, supported sizes: 1,2,4,8,16.\n");
+        return 1;
+    }
+
+    FILE *file = fopen(file_path,"rb");
+    if (!file) {
+        perror("error openin the file");
+        return 1;
+    }
+
+    unsigned char buffer[16];
+    size_t bytes_read;
+    size_t offset = 0;
+
+    while ((bytes_read=fread(buffer,1,16,file))>0) {
+        fprintf(output_stream, "%08lx: ", offset);
+        offset += bytes_read;
+        for (size_t i = 0;i<16; i+=(size_t)group_size) {
+            if (i < bytes_read) {
+                for (size_t j = 0; j < (size_t)group_size; j++) {
+                    if (i + j < bytes_read) {
+                        fprintf(output_stream,"%02x",buffer[i + j]);
+                    } else {
+                        fprintf(output_stream,"  ");
+                    }
+                }
+                fprintf(output_stream," ");
+            } else {
+                for (size_t j=0;j<(size_t)(group_size *2+1);j++) {
+                    fprintf(output_stream, " ");
+                }
+            }
+        }
+        fprintf(output_stream, " ");
+        for (size_t i=0;i<bytes_read; i++) {
+            fprintf(output_stream,"%c",isprint(buffer[i])?buffer[i]:'.');
+        }
+        fprintf(output_stream, "\n");
+    }
+    fclose(file);
+    return 0;
+}
+
+static int builtin_exit(struct command_t *command) {
+    exit_requested = true;
+    return command->args[1] ? atoi(command->args[1]) : last_status;
+}
+
+static int builtin_cd(struct command_t *command) {
+    const char *dir = command->args[1] ? command->args[1] : getenv("HOME");
+    if (dir == NULL){
+        fprintf(stderr, "-%s: cd: HOME is not set!\n", sysname);
+        return 1;
+    } else if (chdir(dir)==-1) {
+        fprintf(stderr, "-%s: cd: %s: %s\n", sysname, dir, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+static bool is_pid(const char *arg) {
+    if (!*arg)
+        return false;
+    for (; *arg; arg++) {
+        if (!isdigit((unsigned char)*arg))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * psvis PID [output file]
+ * psvis [-o output file] PID...
+ * psvis -w PID [events]
+ *
+ * Without -o a second argument is the output file, as it always was, so
+ * several PIDs need -o, where - is stdout.
+ */
+static int builtin_psvis(struct command_t *command) {
+    char **args = command->args + 1;
+    const char *output_file = NULL;
+    int nr_pids = 0;
+
+    // follow the tree, optionally stopping after a number of changes
+    if (args[0] && strcmp(args[0], "-w") == 0 && args[1]) {
+        long max_events = args[2] ? atol(args[2]) : 0;
+        return psvis_watch(atoi(args[1]), max_events, stdout);
+    }
+    if (args[0] && strcmp(args[0], "-o") == 0 && args[1]) {
+        if (strcmp(args[1], "-") != 0)
+            output_file = args[1];
+        args += 2;
+        while (args[nr_pids] && is_pid(args[nr_pids]))
+            nr_pids++;
+        if (args[nr_pids])
+            nr_pids = 0; // not a PID
+    } else if (args[0] && is_pid(args[0]) && (!args[1] || !args[2])) {
+        nr_pids = 1;
+        output_file = args[1];
+    }
+    if (!nr_pids || nr_pids > PSVIS_MAX_ROOTS) {
+        fprintf(stderr, "Usage: psvis <PID> [output file]\n"
+                        "       psvis [-o <output file>] <PID>..., at most %d\n"
+                        "       psvis -w <PID> [events]\n", PSVIS_MAX_ROOTS);
+        return 2;
+    }
+    return psvis_command(args, nr_pids, output_file);
+}
+
+static int builtin_kuhex(struct command_t *command) {
+    if (!command->args[1]) {
+        fprintf(stderr, "Usage: kuhex <file> [-g group_size]\n"
+                        "       kuhex -r <dump> <output file>\n");
+        return 2;
+    }
+    // back from a dump to the bytes, the group size is read off the dump
+    if (strcmp(command->args[1], "-r") == 0) {
+        if (!command->args[2] || !command->args[3]) {
+            fprintf(stderr, "Usage: kuhex -r <dump> <output file>\n");
+            return 2;
+        }
+        return kuhex_reverse(command->args[2], command->args[3]);
+    }
+
+    const char *file_path = command->args[1];
+    int group_size = 1;
+    if (command->args[2] && command->args[3] &&
+        strcmp(command->args[2], "-g") == 0) {
+        group_size = atoi(command->args[3]);
+        if (group_size <= 0) {
+            fprintf(stderr, "invalid group size: %s\n", command->args[3]);
+            return 2;
+        }
+    }
+    return kuhex(file_path, group_size, stdout);
+}
+
+static int builtin_stats(struct command_t *command) {
+    bool verbose = false;
+    for (int i = 1; command->args[i]; i++) {
+        if (strcmp(command->args[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(command->args[i], "-r") == 0) {
+            stats_reset();
+            return 0;
+        } else {
+            fprintf(stderr, "Usage: stats [-v] [-r]\n");
+            return 2;
+        }
+    }
+    stats_print(stdout, verbose);
+    return 0;
+}
+
+static const struct builtin builtins[] = {
+    { "cd", builtin_cd },
+    { "exit", builtin_exit },
+    { "kuhex", builtin_kuhex },
+    { "parallel", builtin_parallel },
+    { "psvis", builtin_psvis },
+    { "stats", builtin_stats },
+};
+
+/**
+ * Look up a builtin by name
+ * @param  name command name
+ * @return      the builtin or NULL for external commands
+ */
+const struct builtin *find_builtin(const char *name) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(builtins[i].name, name) == 0)
+            return &builtins[i];
+    }
+    return NULL;
+}
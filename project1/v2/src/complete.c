@@ -0,0 +1,127 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "complete.h"
+#include "lineedit.h"
+
+/**
+ * Collect the executables in PATH and the files in the current directory
+ * whose names start with prefix
+ * @param  prefix  what to complete
+ * @param  matches filled with distinct matching names
+ * @param  max     size of matches
+ * @return         number of matches
+ */
+int completion_matches(const char *prefix, char matches[][COMPLETE_NAME_MAX],
+                       int max) {
+    struct dirent *entry;
+    DIR *dp;
+    char *path_env, *path_copy, *token;
+    int match_count = 0;
+
+    path_env = getenv("PATH");
+    if (!path_env) path_env = "/bin:/usr/bin";
+
+    path_copy = strdup(path_env);
+    token = strtok(path_copy, ":");
+    while (token && match_count < max) {
+        dp = opendir(token);
+        if (dp) {
+            while ((entry = readdir(dp)) != NULL) {
+                if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0) {
+                    if (!is_duplicate(matches, match_count, entry->d_name)) {
+                        snprintf(matches[match_count++], COMPLETE_NAME_MAX, "%s", entry->d_name);
+                        if (match_count >= max) break;
+                    }
+                }
+            }
+            closedir(dp);
+        }
+        token = strtok(NULL, ":");
+    }
+    free(path_copy);
+
+    dp = match_count < max ? opendir(".") : NULL;
+    if (dp) {
+        while ((entry = readdir(dp)) != NULL) {
+            if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0) {
+                if (!is_duplicate(matches, match_count, entry->d_name)) {
+                    snprintf(matches[match_count++], COMPLETE_NAME_MAX, "%s", entry->d_name);
+                    if (match_count >= max) break;
+                }
+            }
+        }
+        closedir(dp);
+    }
+    return match_count;
+}
+
+//autocomplete
+void autocomplete(struct lineedit *le, int tab_count) {
+    char prefix[COMPLETE_NAME_MAX];
+    static char matches[COMPLETE_MAX_MATCHES][COMPLETE_NAME_MAX];
+    int match_count = 0, i, j;
+    size_t start = lineedit_word_start(le);
+
+    if (tab_count > 1) {
+        list_cd();
+        return;
+    }
+    snprintf(prefix, sizeof(prefix), "%.*s", (int)(le->pos - start),
+             le->buf + start);
+    match_count = completion_matches(prefix, matches, COMPLETE_MAX_MATCHES);
+
+    if (match_count == 0) {
+        printf("\nNo matches found.\n");
+    } else if (match_count == 1) {
+        lineedit_replace(le, start, le->pos, matches[0], strlen(matches[0]));
+    } else {
+        int prefix_len = strlen(matches[0]);
+        for (i = 1; i < match_count; i++) {
+            for (j = 0; j < prefix_len; j++) {
+                if (matches[0][j] != matches[i][j]) {
+                    prefix_len = j;
+                    break;
+                }
+            }
+        }
+        if (prefix_len > (int)strlen(prefix)) {
+            lineedit_replace(le, start, le->pos, matches[0], prefix_len);
+        }
+
+        printf("\nPossible matches:\n");
+        for (i = 0; i < match_count; i++) {
+            printf("%s  ", matches[i]);
+        }
+        printf("\n");
+    }
+}
+
+//helper
+int is_duplicate(char matches[][COMPLETE_NAME_MAX], int match_count, const char *new_match) {
+    for (int i = 0; i < match_count; i++) {
+        if (strcmp(matches[i], new_match) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//listing current directory
+void list_cd(void) {
+    struct dirent *entry;
+    DIR *dp = opendir(".");
+    if (!dp) return;
+
+    printf("\nFiles in current directory:\n");
+    while ((entry = readdir(dp)) != NULL) {
+        if (entry->d_name[0] == '.') {// for hidden files to not show
+            continue;
+        }
+        printf("%s  ", entry->d_name);
+    }
+    closedir(dp);
+    printf("\n");
+}
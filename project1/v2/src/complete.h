@@ -0,0 +1,16 @@
+#ifndef DASH_COMPLETE_H
+#define DASH_COMPLETE_H
+
+#include "lineedit.h"
+
+#define COMPLETE_MAX_MATCHES 1024
+#define COMPLETE_NAME_MAX 4096
+
+void autocomplete(struct lineedit *le, int tab_count);
+int completion_matches(const char *prefix, char matches[][COMPLETE_NAME_MAX],
+                       int max);
+int is_duplicate(char matches[][COMPLETE_NAME_MAX], int match_count,
+                 const char *new_match);
+void list_cd(void);
+
+#endif
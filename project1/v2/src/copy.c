@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "copy.h"
+#include "shell.h"
+
+/*
+ * Moving data between file descriptors without passing it through user
+ * space: copy_file_range between regular files, splice when either side
+ * is a pipe and sendfile for anything the input can be spliced from. Each
+ * one falls through to the next when the kernel does not support it for
+ * the pair of files, read/write being the last resort.
+ */
+
+#define COPY_CHUNK (1 << 30)
+#define COPY_BUF_SIZE 65536
+
+// errors that mean the method cannot be used for these files
+static bool unsupported(int err) {
+	return err == EINVAL || err == ENOSYS || err == EXDEV ||
+		   err == EOPNOTSUPP || err == EBADF;
+}
+
+static ssize_t copy_rw(int in_fd, int out_fd) {
+	char buf[COPY_BUF_SIZE];
+	ssize_t total = 0, n;
+
+	while ((n = read(in_fd, buf, sizeof(buf))) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (ssize_t done = 0; done < n;) {
+			ssize_t w = write(out_fd, buf + done, n - done);
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+			done += w;
+		}
+		total += n;
+	}
+	return total;
+}
+
+/**
+ * Copy the rest of in_fd to out_fd, in the kernel when possible
+ * @param  in_fd  source, read from its current offset
+ * @param  out_fd destination, written at its current offset
+ * @return        bytes copied or -1 with errno set
+ */
+ssize_t copy_fd(int in_fd, int out_fd) {
+	struct stat in, out;
+	ssize_t total = 0, n;
+
+	if (fstat(in_fd, &in) < 0 || fstat(out_fd, &out) < 0)
+		return -1;
+
+	// procfs files report a size of 0, and copy_file_range copies nothing
+	// from them on older kernels instead of failing
+	if (S_ISREG(in.st_mode) && in.st_size > 0 && S_ISREG(out.st_mode)) {
+		while ((n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK,
+									0)) != 0) {
+			if (n > 0)
+				total += n;
+			else if (errno != EINTR)
+				break;
+		}
+		if (n == 0)
+			return total;
+		if (!unsupported(errno))
+			return -1;
+	}
+
+	if (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode)) {
+		while ((n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK,
+						   SPLICE_F_MOVE)) != 0) {
+			if (n > 0)
+				total += n;
+			else if (errno != EINTR)
+				break;
+		}
+		if (n == 0)
+			return total;
+		if (!unsupported(errno))
+			return -1;
+	}
+
+	while ((n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK)) != 0) {
+		if (n > 0)
+			total += n;
+		else if (errno != EINTR)
+			break;
+	}
+	if (n == 0)
+		return total;
+	if (!unsupported(errno))
+		return -1;
+
+	n = copy_rw(in_fd, out_fd);
+	return n < 0 ? -1 : total + n;
+}
+
+// pipe capacity from DASH_PIPE_SIZE, in bytes or with a k/m suffix, 0 if
+// unset or out of the int range F_SETPIPE_SZ takes
+static long pipe_size(void) {
+	const char *env = getenv("DASH_PIPE_SIZE");
+	char *end;
+	int shift = 0;
+	if (!env || !*env)
+		return 0;
+
+	errno = 0;
+	long size = strtol(env, &end, 10);
+	if (*end == 'k' || *end == 'K')
+		shift = 10;
+	else if (*end == 'm' || *end == 'M')
+		shift = 20;
+	if (errno || size <= 0 || size > INT_MAX >> shift)
+		return 0;
+	return size << shift;
+}
+
+/**
+ * Resize a pipe to the capacity set by DASH_PIPE_SIZE, if any. The kernel
+ * rounds it up to a power of two pages; unprivileged users are limited by
+ * /proc/sys/fs/pipe-max-size.
+ * @param fd either end of the pipe
+ */
+void set_pipe_size(int fd) {
+	static bool warned = false;
+	long size = pipe_size();
+
+	if (size && fcntl(fd, F_SETPIPE_SZ, size) < 0 && !warned) {
+		fprintf(stderr, "-%s: DASH_PIPE_SIZE: %s\n", sysname, strerror(errno));
+		warned = true;
+	}
+}
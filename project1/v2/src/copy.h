@@ -0,0 +1,9 @@
+#ifndef DASH_COPY_H
+#define DASH_COPY_H
+
+#include <sys/types.h>
+
+ssize_t copy_fd(int in_fd, int out_fd);
+void set_pipe_size(int fd);
+
+#endif
@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "copy.h"
+#include "shell.h"
+#include "stats.h"
+
+const char *sysname = "dash";
+int last_status = 0;
+
+static const int redirect_fd[3] = { STDIN_FILENO, STDOUT_FILENO, STDOUT_FILENO };
+static const int redirect_flags[3] = {
+    O_RDONLY,
+    O_WRONLY | O_CREAT | O_TRUNC,
+    O_WRONLY | O_CREAT | O_APPEND,
+};
+
+/**
+ * Open the redirect files of a command onto stdin/stdout
+ * @param  command the command
+ * @return         0 on success, -1 if a file could not be opened
+ */
+int apply_redirects(struct command_t *command) {
+    for (int i = 0; i < 3; i++) {
+        if (!command->redirects[i])
+            continue;
+        int fd = open(command->redirects[i], redirect_flags[i] | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "-%s: %s: %s\n", sysname, command->redirects[i],
+                    strerror(errno));
+            return -1;
+        }
+        dup2(fd, redirect_fd[i]);
+        close(fd);
+    }
+    return 0;
+}
+
+static bool has_redirects(struct command_t *command) {
+    return command->redirects[0] || command->redirects[1] ||
+           command->redirects[2];
+}
+
+int wait_status(int status) {
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// reap finished background jobs so they don't linger as zombies
+static void reap_background(void) {
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+}
+
+/**
+ * Replace the current process with an external command, searching PATH
+ * when the name has no slash. Does not return, the process exits with
+ * 127 or 126 if the command cannot be run.
+ */
+void exec_external(struct command_t *command) {
+    if (strchr(command->name, '/')) {
+        execv(command->name, command->args);
+    } else {
+        char *path_env = getenv("PATH");
+        if (!path_env) path_env = "/bin:/usr/bin";
+        char *path_copy = strdup(path_env);
+        char *token = strtok(path_copy, ":");
+        while (token) {
+            char fullpath[1024];
+            snprintf(fullpath, sizeof(fullpath), "%s/%s", token, command->name);
+            if (access(fullpath, X_OK) == 0) {
+                execv(fullpath, command->args);
+            }
+            token = strtok(NULL, ":");
+        }
+        free(path_copy);
+    }
+    fprintf(stderr, "-%s: %s: %s\n", sysname, command->name,
+            errno == ENOENT ? "command not found" : strerror(errno));
+    _exit(errno == ENOENT ? 127 : 126);
+}
+
+/**
+ * Run a builtin in the shell process itself, with its redirects applied
+ * around the call.
+ */
+static int run_builtin(const struct builtin *builtin,
+                       struct command_t *command) {
+    int saved_in = -1, saved_out = -1;
+    int status = 1;
+
+    if (has_redirects(command)) {
+        fflush(stdout);
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    }
+
+    if (apply_redirects(command) == 0)
+        status = builtin->fn(command);
+
+    if (saved_out >= 0) {
+        fflush(stdout);
+        dup2(saved_in, STDIN_FILENO);
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_in);
+        close(saved_out);
+    }
+
+    last_status = status;
+    return exit_requested ? EXIT : SUCCESS;
+}
+
+static double timeval_sec(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// add the rusage of a child to the pipeline total
+static void usage_add(struct rusage *total, const struct rusage *ru) {
+    timeradd(&total->ru_utime, &ru->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &ru->ru_stime, &total->ru_stime);
+    if (ru->ru_maxrss > total->ru_maxrss)
+        total->ru_maxrss = ru->ru_maxrss;
+    total->ru_nvcsw += ru->ru_nvcsw;
+    total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/*
+ * The report printed by the time prefix, to stderr like bash. maxrss is
+ * the peak of the biggest stage. A builtin run in the shell process has
+ * only the shell's lifetime peak to go by, so its maxrss is that peak when
+ * the builtin raised it and n/a (ru_maxrss < 0) when it did not.
+ */
+static void print_time(double usec, const struct rusage *ru) {
+    double real = usec / 1e6;
+    double user = timeval_sec(ru->ru_utime), sys = timeval_sec(ru->ru_stime);
+    fprintf(stderr, "\nreal\t%dm%.3fs\n", (int)(real / 60), real - 60 * (int)(real / 60));
+    fprintf(stderr, "user\t%dm%.3fs\n", (int)(user / 60), user - 60 * (int)(user / 60));
+    fprintf(stderr, "sys\t%dm%.3fs\n", (int)(sys / 60), sys - 60 * (int)(sys / 60));
+    if (ru->ru_maxrss < 0)
+        fprintf(stderr, "maxrss\tn/a\n");
+    else
+        fprintf(stderr, "maxrss\t%ld KiB\n", ru->ru_maxrss);
+    fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n", ru->ru_nvcsw,
+            ru->ru_nivcsw);
+}
+
+/*
+ * How long each stage took from fork to exec. Every child holds the write
+ * end of a pipe that exec closes, so EOF on the read end means the child
+ * got there. The stages are all forked first and then waited for at once,
+ * so they exec in parallel and the wait is that of the slowest one.
+ */
+static void record_exec_times(struct pollfd *fds, const double *forked,
+                              int count) {
+    int left = 0;
+
+    for (int i = 0; i < count; i++)
+        left += fds[i].fd >= 0;
+    while (left > 0) {
+        if (poll(fds, count, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        double now = stats_now();
+        for (int i = 0; i < count; i++) {
+            if (fds[i].fd < 0 || !fds[i].revents)
+                continue;
+            stats_record_phase(STATS_EXEC, now - forked[i]);
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            left--;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (fds[i].fd >= 0)
+            close(fds[i].fd);
+    }
+}
+
+/**
+ * Start every stage of a pipeline. Builtins in a pipeline run in a child
+ * like any other stage. A foreground pipeline returns once every stage
+ * has exec'd, a background one right after the forks.
+ * @param  command first stage
+ * @param  pids    filled with the pid of each stage started
+ * @return         number of stages started
+ */
+int start_pipeline(struct command_t *command, pid_t *pids) {
+    int fd_in = STDIN_FILENO;
+    int pipe_fd[2];
+    int count = 0, stages = 0;
+
+    for (struct command_t *c = command; c; c = c->next)
+        stages++;
+    // background jobs are not waited for, not even until they exec
+    struct pollfd *exec_fds = NULL;
+    double *forked = NULL;
+    if (!command->background) {
+        exec_fds = arena_alloc(&command->arena, sizeof(*exec_fds) * stages);
+        forked = arena_alloc(&command->arena, sizeof(*forked) * stages);
+    }
+
+    for (struct command_t *current = command; current; current = current->next) {
+        pipe_fd[0] = pipe_fd[1] = -1;
+        if (current->next && pipe2(pipe_fd, O_CLOEXEC) < 0) {
+            perror("pipe");
+            break;
+        }
+        if (current->next)
+            set_pipe_size(pipe_fd[1]);
+
+        // closed by exec, so EOF on it tells the parent the child got there
+        int exec_fd[2] = { -1, -1 };
+        if (exec_fds && pipe2(exec_fd, O_CLOEXEC) < 0)
+            exec_fd[0] = exec_fd[1] = -1;
+
+        fflush(stdout); // don't hand buffered output to the child
+        double fork_start = stats_now();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork error!");
+            if (current->next) {
+                close(pipe_fd[0]);
+                close(pipe_fd[1]);
+            }
+            if (exec_fd[0] >= 0) {
+                close(exec_fd[0]);
+                close(exec_fd[1]);
+            }
+            break;
+        }
+
+        if (pid == 0) {
+            if (exec_fd[0] >= 0)
+                close(exec_fd[0]);
+            if (fd_in != STDIN_FILENO) {
+                dup2(fd_in, STDIN_FILENO);
+                close(fd_in);
+            }
+            if (current->next) {
+                dup2(pipe_fd[1], STDOUT_FILENO);
+                close(pipe_fd[0]);
+                close(pipe_fd[1]);
+            }
+            if (apply_redirects(current) < 0)
+                _exit(1);
+
+            const struct builtin *builtin = find_builtin(current->name);
+            if (builtin) {
+                if (exec_fd[1] >= 0)
+                    close(exec_fd[1]);
+                int status = builtin->fn(current);
+                fflush(stdout);
+                _exit(status);
+            }
+            exec_external(current);
+        }
+
+        double fork_end = stats_now();
+        stats_record_phase(STATS_FORK, fork_end - fork_start);
+        if (exec_fds) {
+            if (exec_fd[1] >= 0)
+                close(exec_fd[1]);
+            exec_fds[count].fd = exec_fd[0];
+            exec_fds[count].events = POLLIN;
+            forked[count] = fork_end;
+        }
+
+        pids[count++] = pid;
+        if (fd_in != STDIN_FILENO)
+            close(fd_in);
+        if (current->next) {
+            close(pipe_fd[1]);
+            fd_in = pipe_fd[0];
+        }
+    }
+
+    if (fd_in != STDIN_FILENO)
+        close(fd_in);
+    if (exec_fds)
+        record_exec_times(exec_fds, forked, count);
+    return count;
+}
+
+/**
+ * Run a pipeline and wait for it unless it is in the background
+ * @param  command first stage
+ * @param  usage   summed resource usage of the stages
+ * @return         SUCCESS, EXIT or UNKNOWN if a stage could not start
+ */
+static int run_pipeline(struct command_t *command, struct rusage *usage) {
+    const struct builtin *builtin = find_builtin(command->name);
+    if (builtin && !command->next && !command->background) {
+        struct rusage before, after;
+        getrusage(RUSAGE_SELF, &before);
+        int code = run_builtin(builtin, command);
+        getrusage(RUSAGE_SELF, &after);
+        timersub(&after.ru_utime, &before.ru_utime, &usage->ru_utime);
+        timersub(&after.ru_stime, &before.ru_stime, &usage->ru_stime);
+        usage->ru_maxrss =
+            after.ru_maxrss > before.ru_maxrss ? after.ru_maxrss : -1;
+        usage->ru_nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+        usage->ru_nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+        return code;
+    }
+
+    int stages = 0;
+    for (struct command_t *c = command; c; c = c->next)
+        stages++;
+    pid_t *pids = arena_alloc(&command->arena, sizeof(pid_t) * stages);
+
+    int started = start_pipeline(command, pids);
+    if (started < stages)
+        last_status = 1;
+
+    if (command->background) {
+        struct command_t *current = command;
+        for (int i = 0; i < started; i++, current = current->next)
+            printf("[%d] %s\n", pids[i], current->name);
+        return SUCCESS;
+    }
+
+    double wait_start = stats_now();
+    for (int i = 0; i < started; i++) {
+        int status;
+        struct rusage ru;
+        pid_t pid;
+        while ((pid = wait4(pids[i], &status, 0, &ru)) < 0 && errno == EINTR)
+            ;
+        if (pid < 0) {
+            // reaped by someone else, its status and usage are gone
+            perror("wait4");
+            if (i == stages - 1)
+                last_status = 127;
+            continue;
+        }
+        usage_add(usage, &ru);
+        if (i == stages - 1)
+            last_status = wait_status(status);
+    }
+    stats_record_phase(STATS_WAIT, stats_now() - wait_start);
+    return started < stages ? UNKNOWN : SUCCESS;
+}
+
+int process_command(struct command_t *command) {
+    struct rusage usage;
+    bool timed = false;
+
+    reap_background();
+
+    if (strcmp(command->name, "time") == 0) {
+        // time prefix, the rest of the line is the pipeline to measure
+        timed = true;
+        command->args++;
+        command->arg_count--;
+        command->name = command->args[0] ? command->args[0] : "";
+    }
+
+    if (command->name[0] == '\0' && !timed)
+        return SUCCESS;
+
+    memset(&usage, 0, sizeof(usage));
+    double start = stats_now();
+    int code = command->name[0] ? run_pipeline(command, &usage) : SUCCESS;
+    double elapsed = stats_now() - start;
+
+    if (command->name[0])
+        stats_record_command(command->name, elapsed);
+    if (timed)
+        print_time(elapsed, &usage);
+    return code;
+}
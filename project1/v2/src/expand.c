@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "expand.h"
+
+/*
+ * Pathname expansion. Every path component of a pattern is compiled into
+ * a bit-parallel NFA (one bit per token, bit k set means "k tokens
+ * matched") so a name is matched in a single pass over its bytes without
+ * backtracking. Directories are read with getdents64 into one buffer per
+ * directory and walked in place; nothing is allocated for entries that
+ * do not match. The listings are cached for the whole command line, so
+ * several patterns on one line that walk the same directories read each
+ * of them once.
+ */
+
+#define GLOB_READ_SIZE 65536
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct glob_dir {
+	char *path;
+	char *buf; // raw getdents64 records
+	size_t len;
+	struct glob_dir *next;
+};
+
+struct glob_pat {
+	uint64_t match[256]; // tokens that accept each byte
+	uint64_t star; // tokens that are *
+	uint64_t accept;
+	bool dot; // starts with a literal '.'
+};
+
+struct component {
+	char *literal; // unescaped text when the component has no wildcard
+	struct glob_pat *pat;
+};
+
+struct expander {
+	struct glob_cache *cache;
+	struct arena *arena;
+	struct component *comps;
+	int ncomps;
+	bool dir_only; // pattern ended with '/'
+	char *path; // path being built, grown with realloc
+	size_t path_cap;
+	char **out;
+	int count;
+	int cap;
+};
+
+static void *xrealloc(void *p, size_t size) {
+	p = realloc(p, size);
+	if (!p) {
+		perror("glob");
+		exit(1);
+	}
+	return p;
+}
+
+static struct glob_dir *read_dir(struct glob_cache *cache, const char *path) {
+	struct glob_dir *dir;
+	for (dir = cache->dirs; dir; dir = dir->next) {
+		if (strcmp(dir->path, path) == 0)
+			return dir;
+	}
+
+	dir = calloc(1, sizeof(*dir));
+	if (!dir || !(dir->path = strdup(path))) {
+		perror("glob");
+		exit(1);
+	}
+	dir->next = cache->dirs;
+	cache->dirs = dir;
+
+	// an unreadable directory is cached as empty
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return dir;
+
+	size_t cap = 0;
+	while (1) {
+		if (cap - dir->len < GLOB_READ_SIZE) {
+			cap = cap ? cap * 2 : GLOB_READ_SIZE;
+			dir->buf = xrealloc(dir->buf, cap);
+		}
+		long n = syscall(SYS_getdents64, fd, dir->buf + dir->len,
+						 cap - dir->len);
+		if (n <= 0)
+			break;
+		dir->len += n;
+	}
+	close(fd);
+	return dir;
+}
+
+void glob_cache_free(struct glob_cache *cache) {
+	struct glob_dir *dir = cache->dirs, *next;
+	while (dir) {
+		next = dir->next;
+		free(dir->path);
+		free(dir->buf);
+		free(dir);
+		dir = next;
+	}
+	cache->dirs = NULL;
+}
+
+// index of the ']' closing the class opened at s[i], 0 if there is none
+static size_t class_end(const char *s, size_t i, size_t len) {
+	size_t j = i + 1;
+	if (j < len && (s[j] == '!' || s[j] == '^'))
+		j++;
+	if (j < len && s[j] == ']')
+		j++;
+	while (j < len && s[j] != ']') {
+		if (s[j] == '\\')
+			j++;
+		j++;
+	}
+	return j < len ? j : 0;
+}
+
+static void compile_class(struct glob_pat *p, uint64_t bit, const char *s,
+						  size_t i, size_t end) {
+	bool set[256] = { false };
+	bool negate = false;
+	size_t j = i + 1;
+
+	if (s[j] == '!' || s[j] == '^') {
+		negate = true;
+		j++;
+	}
+	for (bool first = true; j < end; first = false) {
+		unsigned char lo = s[j], hi;
+		if (lo == '\\' && j + 1 < end)
+			lo = s[++j];
+		else if (lo == ']' && !first)
+			break;
+		j++;
+		hi = lo;
+		if (j + 1 < end && s[j] == '-') {
+			hi = s[j + 1];
+			if (hi == '\\' && j + 2 < end)
+				hi = s[++j + 1];
+			j += 2;
+		}
+		for (unsigned c = lo; c <= hi; c++)
+			set[c] = true;
+	}
+	for (int c = 1; c < 256; c++) {
+		if (set[c] != negate)
+			p->match[c] |= bit;
+	}
+}
+
+static bool compile(struct glob_pat *p, const char *s, size_t len) {
+	int k = 0;
+	size_t i = 0, end;
+
+	memset(p, 0, sizeof(*p));
+	while (i < len) {
+		if (k == GLOB_MAX_TOKENS)
+			return false;
+		uint64_t bit = 1ULL << k;
+		char c = s[i];
+
+		if (c == '*') {
+			p->star |= bit;
+			while (i < len && s[i] == '*')
+				i++;
+		} else if (c == '?') {
+			for (int b = 1; b < 256; b++)
+				p->match[b] |= bit;
+			i++;
+		} else if (c == '[' && (end = class_end(s, i, len))) {
+			compile_class(p, bit, s, i, end);
+			i = end + 1;
+		} else {
+			if (c == '\\' && i + 1 < len)
+				c = s[++i];
+			p->match[(unsigned char)c] |= bit;
+			if (k == 0 && c == '.')
+				p->dot = true;
+			i++;
+		}
+		k++;
+	}
+	p->accept = 1ULL << k;
+	return true;
+}
+
+// a * may match nothing, so its state also enables the next token
+static uint64_t closure(const struct glob_pat *p, uint64_t d) {
+	uint64_t x;
+	while ((x = ((d & p->star) << 1) & ~d))
+		d |= x;
+	return d;
+}
+
+static bool match(const struct glob_pat *p, const char *name) {
+	if (name[0] == '.' && !p->dot)
+		return false;
+
+	uint64_t d = closure(p, 1);
+	for (const unsigned char *s = (const unsigned char *)name; *s; s++) {
+		d = closure(p, ((d & p->match[*s]) << 1) | (d & p->star));
+		if (!d)
+			return false;
+	}
+	return d & p->accept;
+}
+
+static bool has_wildcard(const char *s, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if (s[i] == '\\')
+			i++;
+		else if (s[i] == '*' || s[i] == '?' ||
+				 (s[i] == '[' && class_end(s, i, len)))
+			return true;
+	}
+	return false;
+}
+
+static char *unescape(struct arena *arena, const char *s, size_t len) {
+	char *out = arena_alloc(arena, len + 1), *w = out;
+	for (size_t i = 0; i < len; i++) {
+		if (s[i] == '\\' && i + 1 < len)
+			i++;
+		*w++ = s[i];
+	}
+	*w = '\0';
+	return out;
+}
+
+static size_t path_append(struct expander *ex, size_t len, const char *name) {
+	size_t n = strlen(name);
+	if (len + n + 2 > ex->path_cap) {
+		ex->path_cap = (len + n + 2) * 2;
+		ex->path = xrealloc(ex->path, ex->path_cap);
+	}
+	if (len > 0 && ex->path[len - 1] != '/')
+		ex->path[len++] = '/';
+	memcpy(ex->path + len, name, n + 1);
+	return len + n;
+}
+
+static void emit(struct expander *ex, size_t len) {
+	if (ex->count == ex->cap) {
+		int cap = ex->cap ? ex->cap * 2 : 16;
+		char **out = arena_alloc(ex->arena, sizeof(char *) * cap);
+		if (ex->count)
+			memcpy(out, ex->out, sizeof(char *) * ex->count);
+		ex->out = out;
+		ex->cap = cap;
+	}
+	if (ex->dir_only)
+		ex->path[len++] = '/';
+	ex->out[ex->count++] = arena_strndup(ex->arena, ex->path, len);
+}
+
+static bool is_dir(const char *path, unsigned char type) {
+	struct stat st;
+	if (type == DT_DIR)
+		return true;
+	if (type != DT_LNK && type != DT_UNKNOWN)
+		return false;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void walk(struct expander *ex, size_t len, int i) {
+	struct stat st;
+
+	if (i == ex->ncomps) {
+		// wildcard components were matched against real entries, but a
+		// literal last component still has to exist
+		if (ex->comps[i - 1].literal && lstat(ex->path, &st) < 0)
+			return;
+		if (ex->dir_only && !is_dir(ex->path, DT_UNKNOWN))
+			return;
+		emit(ex, len);
+		return;
+	}
+
+	struct component *comp = &ex->comps[i];
+	if (comp->literal) {
+		walk(ex, path_append(ex, len, comp->literal), i + 1);
+		return;
+	}
+
+	ex->path[len] = '\0';
+	struct glob_dir *dir = read_dir(ex->cache, len ? ex->path : ".");
+	for (size_t off = 0; off < dir->len;) {
+		struct linux_dirent64 *d = (struct linux_dirent64 *)(dir->buf + off);
+		off += d->d_reclen;
+
+		const char *name = d->d_name;
+		if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+			continue;
+		if (!match(comp->pat, name))
+			continue;
+
+		size_t n = path_append(ex, len, name);
+		if (i + 1 < ex->ncomps || ex->dir_only) {
+			if (!is_dir(ex->path, d->d_type))
+				continue;
+		}
+		walk(ex, n, i + 1);
+		ex->path[len] = '\0';
+	}
+}
+
+static int cmp_str(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Expand a pattern into the sorted list of matching paths. Characters of
+ * the pattern escaped with a backslash match literally.
+ * @param  cache   directory listings shared by the patterns of one line
+ * @param  arena   where the result is allocated
+ * @param  pattern the pattern
+ * @param  matches set to the matching paths
+ * @return         number of matches, 0 if nothing matched
+ */
+int glob_expand(struct glob_cache *cache, struct arena *arena,
+				const char *pattern, char ***matches) {
+	struct expander ex = { .cache = cache, .arena = arena };
+	size_t plen = strlen(pattern);
+	const char *s = pattern;
+
+	ex.comps = arena_alloc(arena, sizeof(struct component) * (plen / 2 + 2));
+	ex.path_cap = plen + 256;
+	ex.path = xrealloc(NULL, ex.path_cap);
+	ex.path[0] = '\0';
+
+	size_t base = 0;
+	if (*s == '/') {
+		ex.path[base++] = '/';
+		ex.path[base] = '\0';
+	}
+
+	while (*s) {
+		while (*s == '/')
+			s++;
+		if (!*s)
+			break;
+		const char *end = s;
+		while (*end && *end != '/') {
+			if (*end == '\\' && end[1])
+				end++;
+			end++;
+		}
+
+		struct component *comp = &ex.comps[ex.ncomps++];
+		size_t len = end - s;
+		if (has_wildcard(s, len)) {
+			comp->pat = arena_alloc(arena, sizeof(struct glob_pat));
+			if (!compile(comp->pat, s, len)) {
+				// too long to match, leave the word alone
+				free(ex.path);
+				return 0;
+			}
+		} else {
+			comp->literal = unescape(arena, s, len);
+		}
+		s = end;
+	}
+	ex.dir_only = plen > 1 && pattern[plen - 1] == '/';
+
+	if (ex.ncomps > 0)
+		walk(&ex, base, 0);
+	free(ex.path);
+
+	qsort(ex.out, ex.count, sizeof(char *), cmp_str);
+	*matches = ex.out;
+	return ex.count;
+}
@@ -0,0 +1,21 @@
+#ifndef DASH_EXPAND_H
+#define DASH_EXPAND_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+#define GLOB_MAX_TOKENS 63 // per path component, one bit each in a uint64_t
+
+struct glob_dir;
+
+// directory listings read while expanding one line, see glob_expand()
+struct glob_cache {
+	struct glob_dir *dirs;
+};
+
+int glob_expand(struct glob_cache *cache, struct arena *arena,
+				const char *pattern, char ***matches);
+void glob_cache_free(struct glob_cache *cache);
+
+#endif
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+
+/*
+ * The history file is plain text, one command per line, and is only ever
+ * appended to with O_APPEND so several shells can share it. It is mmap'ed
+ * read-only and entries in the ring point into the mapping by offset; the
+ * file is remapped whenever another writer (or this shell) grows it. Every
+ * lookup checks the size first, as a mapping past the end of a file that
+ * someone truncated would SIGBUS.
+ */
+struct hist_entry {
+	off_t off;
+	uint32_t len;
+	uint64_t mask; // which (byte & 63) values occur in the entry
+};
+
+static int hist_fd = -1;
+static char *hist_map;
+static size_t hist_maplen;
+static size_t hist_indexed; // bytes of the mapping already in the ring
+static struct hist_entry *hist_ring;
+static long hist_total; // entries ever indexed, the ring keeps the last ones
+
+static uint64_t char_mask(const char *s, size_t len) {
+	uint64_t mask = 0;
+	for (size_t i = 0; i < len; i++)
+		mask |= 1ULL << ((unsigned char)s[i] & 63);
+	return mask;
+}
+
+static struct hist_entry *entry_at(long index) {
+	long first = hist_total - history_count();
+	return &hist_ring[(first + index) % HISTORY_SIZE];
+}
+
+/**
+ * Open (or create) the history file. Nothing is read here, the file is
+ * indexed lazily the first time history is looked at.
+ * @param  path history file
+ * @return      0 on success, -1 if history is unavailable
+ */
+int history_init(const char *path) {
+	hist_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (hist_fd < 0)
+		return -1;
+
+	hist_ring = calloc(HISTORY_SIZE, sizeof(struct hist_entry));
+	if (!hist_ring) {
+		close(hist_fd);
+		hist_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void history_close(void) {
+	if (hist_map)
+		munmap(hist_map, hist_maplen);
+	if (hist_fd >= 0)
+		close(hist_fd);
+	free(hist_ring);
+	hist_map = NULL;
+	hist_ring = NULL;
+	hist_fd = -1;
+	hist_maplen = hist_indexed = 0;
+	hist_total = 0;
+}
+
+// drop the mapping and every entry, the file is not what they point at
+static void history_forget(void) {
+	if (hist_map)
+		munmap(hist_map, hist_maplen);
+	hist_map = NULL;
+	hist_maplen = hist_indexed = 0;
+	hist_total = 0;
+}
+
+/**
+ * Pick up lines appended to the history file since the last call,
+ * including those written by other shells, and start over if the file
+ * was truncated.
+ */
+void history_sync(void) {
+	struct stat st;
+	if (hist_fd < 0 || fstat(hist_fd, &st) < 0)
+		return;
+	if ((size_t)st.st_size < hist_maplen)
+		history_forget();
+	if ((size_t)st.st_size <= hist_maplen)
+		return;
+
+	// the old mapping stays until the new one is there, so a failure
+	// leaves the ring as it was and the next sync tries again
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hist_fd, 0);
+	if (map == MAP_FAILED)
+		return;
+	if (hist_map)
+		munmap(hist_map, hist_maplen);
+	hist_map = map;
+	hist_maplen = st.st_size;
+
+	// a line is only indexed once its newline is there, so a concurrent
+	// half-written append is picked up on a later sync
+	char *p = hist_map + hist_indexed;
+	char *end = hist_map + hist_maplen;
+	char *nl;
+	while (p < end && (nl = memchr(p, '\n', end - p))) {
+		if (nl > p) {
+			struct hist_entry *e = &hist_ring[hist_total % HISTORY_SIZE];
+			e->off = p - hist_map;
+			e->len = nl - p;
+			e->mask = char_mask(p, e->len);
+			hist_total++;
+		}
+		p = nl + 1;
+	}
+	hist_indexed = p - hist_map;
+}
+
+/**
+ * Append a line to the history file. Consecutive duplicates are dropped.
+ * @param line command line, need not be NUL terminated
+ * @param len  length of line
+ */
+void history_add(const char *line, size_t len) {
+	if (hist_fd < 0 || len == 0)
+		return;
+
+	history_sync();
+	size_t last_len;
+	const char *last = history_get(history_count() - 1, &last_len);
+	if (last && last_len == len && memcmp(last, line, len) == 0)
+		return;
+
+	char *rec = malloc(len + 1);
+	if (!rec)
+		return;
+	for (size_t i = 0; i < len; i++)
+		rec[i] = line[i] == '\n' ? ' ' : line[i];
+	rec[len] = '\n';
+	// single O_APPEND write so concurrent shells never interleave a line
+	if (write(hist_fd, rec, len + 1) < 0)
+		perror("history");
+	free(rec);
+	history_sync();
+}
+
+long history_count(void) {
+	return hist_total < HISTORY_SIZE ? hist_total : HISTORY_SIZE;
+}
+
+/**
+ * Get an entry, 0 is the oldest one in the ring
+ * @param  index entry index
+ * @param  len   set to the entry length
+ * @return       pointer into the mapping (not NUL terminated), valid until
+ *               the next history call, or NULL if there is no such entry
+ */
+const char *history_get(long index, size_t *len) {
+	history_sync();
+	if (index < 0 || index >= history_count())
+		return NULL;
+	struct hist_entry *e = entry_at(index);
+	*len = e->len;
+	return hist_map + e->off;
+}
+
+/**
+ * Find the newest entry at or before `from` that contains `needle`
+ * @return entry index or -1
+ */
+long history_search(const char *needle, size_t len, long from) {
+	history_sync();
+	uint64_t mask = char_mask(needle, len);
+	if (from >= history_count())
+		from = history_count() - 1;
+
+	for (long i = from; i >= 0; i--) {
+		struct hist_entry *e = entry_at(i);
+		if (e->len < len || (e->mask & mask) != mask)
+			continue;
+		if (memmem(hist_map + e->off, e->len, needle, len))
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * Find the next entry starting at `from` and moving in direction `dir`
+ * (-1 older, 1 newer) that starts with `prefix`
+ * @return entry index or -1
+ */
+long history_search_prefix(const char *prefix, size_t len, long from, int dir) {
+	history_sync();
+	long count = history_count();
+	for (long i = from; i >= 0 && i < count; i += dir) {
+		struct hist_entry *e = entry_at(i);
+		if (e->len >= len && memcmp(hist_map + e->off, prefix, len) == 0)
+			return i;
+	}
+	return -1;
+}
@@ -0,0 +1,18 @@
+#ifndef DASH_HISTORY_H
+#define DASH_HISTORY_H
+
+#include <stddef.h>
+
+// number of entries kept in the in-memory ring
+#define HISTORY_SIZE (1 << 20)
+
+int history_init(const char *path);
+void history_close(void);
+void history_sync(void);
+void history_add(const char *line, size_t len);
+long history_count(void);
+const char *history_get(long index, size_t *len);
+long history_search(const char *needle, size_t len, long from);
+long history_search_prefix(const char *prefix, size_t len, long from, int dir);
+
+#endif
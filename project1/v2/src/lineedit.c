@@ -0,0 +1,579 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "lineedit.h"
+
+/*
+ * Input is read in blocks and run through a small state machine that
+ * splits it into plain text runs, control keys and escape sequences.
+ * The screen is redrawn once per block with a single write(), so a large
+ * paste costs one redraw rather than one per byte.
+ */
+
+enum le_state {
+	LE_NORMAL,
+	LE_ESC, // got ESC
+	LE_CSI, // got ESC [
+	LE_SS3, // got ESC O
+};
+
+enum le_key {
+	KEY_NONE = 0,
+	KEY_UP = 256,
+	KEY_DOWN,
+	KEY_RIGHT,
+	KEY_LEFT,
+	KEY_HOME,
+	KEY_END,
+	KEY_DELETE,
+	KEY_PASTE_START,
+	KEY_PASTE_END,
+};
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+
+static void grow(char **buf, size_t *cap, size_t need) {
+	if (need <= *cap)
+		return;
+	size_t n = *cap ? *cap : 256;
+	while (n < need)
+		n *= 2;
+	char *p = realloc(*buf, n);
+	if (!p) {
+		perror("lineedit");
+		exit(1);
+	}
+	*buf = p;
+	*cap = n;
+}
+
+static void out_append(struct lineedit *le, const char *s, size_t n) {
+	grow(&le->out, &le->out_cap, le->out_len + n);
+	memcpy(le->out + le->out_len, s, n);
+	le->out_len += n;
+}
+
+static void out_puts(struct lineedit *le, const char *s) {
+	out_append(le, s, strlen(s));
+}
+
+static void out_flush(struct lineedit *le) {
+	size_t off = 0;
+	while (off < le->out_len) {
+		ssize_t n = write(STDOUT_FILENO, le->out + off, le->out_len - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += n;
+	}
+	le->out_len = 0;
+}
+
+static bool is_cont(char c) {
+	return ((unsigned char)c & 0xc0) == 0x80;
+}
+
+// display columns of buf[from, to), UTF-8 continuation bytes take none
+static size_t columns(const char *s, size_t from, size_t to) {
+	size_t n = 0;
+	for (size_t i = from; i < to; i++)
+		n += !is_cont(s[i]);
+	return n;
+}
+
+static size_t prev_char(const struct lineedit *le, size_t pos) {
+	while (pos > 0 && is_cont(le->buf[--pos]))
+		;
+	return pos;
+}
+
+static size_t next_char(const struct lineedit *le, size_t pos) {
+	while (pos < le->len && is_cont(le->buf[++pos]))
+		;
+	return pos;
+}
+
+static size_t term_columns(void) {
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_col == 0)
+		return 80;
+	return ws.ws_col;
+}
+
+/**
+ * Replace buf[from, to) with text and leave the cursor after it
+ */
+void lineedit_replace(struct lineedit *le, size_t from, size_t to,
+					  const char *text, size_t len) {
+	grow(&le->buf, &le->cap, le->len - (to - from) + len + 1);
+	memmove(le->buf + from + len, le->buf + to, le->len - to + 1);
+	memcpy(le->buf + from, text, len);
+	le->len = le->len - (to - from) + len;
+	le->pos = from + len;
+}
+
+size_t lineedit_word_start(const struct lineedit *le) {
+	size_t start = le->pos;
+	while (start > 0 && le->buf[start - 1] != ' ' && le->buf[start - 1] != '\t')
+		start--;
+	return start;
+}
+
+static void set_line(struct lineedit *le, const char *line, size_t len) {
+	le->len = le->pos = 0;
+	le->buf[0] = '\0';
+	lineedit_replace(le, 0, 0, line, len);
+}
+
+/**
+ * Redraw the line. Lines wider than the terminal scroll horizontally
+ * so the cursor stays visible.
+ */
+static void refresh(struct lineedit *le) {
+	size_t cols = term_columns();
+	char seq[32];
+
+	if (le->searching) {
+		size_t len = 0;
+		const char *match = le->found >= 0 ? history_get(le->found, &len) : NULL;
+		if (!match) { // none, or gone with a truncated history file
+			match = "";
+			len = 0;
+		}
+		int n = snprintf(seq, sizeof(seq), "(%sreverse-i-search)`",
+						 le->failed ? "failed " : "");
+		out_puts(le, "\r");
+		out_append(le, seq, n);
+		out_append(le, le->query, le->query_len);
+		out_puts(le, "': ");
+		size_t used = n + le->query_len + 3;
+		if (used + len >= cols)
+			len = used < cols ? cols - used - 1 : 0;
+		out_append(le, match, len);
+		out_puts(le, "\033[K");
+		out_flush(le);
+		return;
+	}
+
+	size_t prompt_cols = strlen(le->prompt);
+	size_t avail = prompt_cols + 8 < cols ? cols - prompt_cols - 1 : 8;
+
+	if (le->pos < le->scroll)
+		le->scroll = le->pos;
+	if (columns(le->buf, le->scroll, le->pos) >= avail) {
+		size_t c = 0;
+		le->scroll = le->pos;
+		while (le->scroll > 0 && c < avail - 1) {
+			le->scroll = prev_char(le, le->scroll);
+			c++;
+		}
+	}
+
+	size_t end = le->scroll, c = 0;
+	while (end < le->len && c < avail) {
+		end = next_char(le, end);
+		c++;
+	}
+
+	out_puts(le, "\r");
+	out_puts(le, le->prompt);
+	out_append(le, le->buf + le->scroll, end - le->scroll);
+	out_puts(le, "\033[K\r");
+	size_t cursor = prompt_cols + columns(le->buf, le->scroll, le->pos);
+	if (cursor > 0)
+		out_append(le, seq, snprintf(seq, sizeof(seq), "\033[%zuC", cursor));
+	out_flush(le);
+}
+
+static void history_move(struct lineedit *le, int dir) {
+	if (le->hist_pos < 0) {
+		// start browsing, what was typed so far is the prefix
+		history_sync();
+		le->hist_pos = history_count();
+		grow(&le->hist_prefix, &le->hist_prefix_cap, le->len + 1);
+		memcpy(le->hist_prefix, le->buf, le->len);
+		le->hist_prefix_len = le->len;
+	}
+
+	long next = le->hist_pos + dir;
+	size_t len;
+	const char *line;
+	while ((next = history_search_prefix(le->hist_prefix, le->hist_prefix_len,
+										 next, dir)) >= 0) {
+		line = history_get(next, &len);
+		if (!line || len != le->len || memcmp(line, le->buf, len) != 0)
+			break;
+		next += dir; // skip entries identical to the shown one
+	}
+
+	if (next >= 0 && (line = history_get(next, &len))) {
+		le->hist_pos = next;
+		set_line(le, line, len);
+	} else if (dir > 0) {
+		// past the newest entry, back to what was typed
+		le->hist_pos = history_count();
+		set_line(le, le->hist_prefix, le->hist_prefix_len);
+	}
+}
+
+static void search_update(struct lineedit *le, long from) {
+	long f = history_search(le->query, le->query_len, from);
+	le->failed = f < 0;
+	if (f >= 0)
+		le->found = f;
+}
+
+/**
+ * Handle a key while in Ctrl-R search
+ * @return true if the key was consumed by the search
+ */
+static bool search_key(struct lineedit *le, int key) {
+	switch (key) {
+	case KEY_CTRL('r'):
+		if (le->found > 0)
+			search_update(le, le->found - 1);
+		else
+			le->failed = true;
+		return true;
+	case 127:
+	case KEY_CTRL('h'):
+		if (le->query_len > 0)
+			le->query_len--;
+		le->found = -1;
+		le->failed = false;
+		if (le->query_len > 0)
+			search_update(le, history_count() - 1);
+		return true;
+	case KEY_CTRL('g'):
+		le->searching = false;
+		return true;
+	}
+
+	// anything else accepts the match and is then handled as usual
+	le->searching = false;
+	if (le->found >= 0) {
+		size_t len;
+		const char *line = history_get(le->found, &len);
+		if (line)
+			set_line(le, line, len);
+	}
+	return false;
+}
+
+static void insert_text(struct lineedit *le, const char *text, size_t len) {
+	if (le->searching) {
+		grow(&le->query, &le->query_cap, le->query_len + len);
+		memcpy(le->query + le->query_len, text, len);
+		le->query_len += len;
+		search_update(le, le->found >= 0 ? le->found : history_count() - 1);
+		return;
+	}
+	lineedit_replace(le, le->pos, le->pos, text, len);
+	le->hist_pos = -1;
+	le->tab_count = 0;
+}
+
+static void handle_key(struct lineedit *le, int key) {
+	size_t p;
+
+	if (key == KEY_NONE)
+		return;
+	if (le->searching && search_key(le, key))
+		return;
+	if (key != '\t')
+		le->tab_count = 0;
+
+	switch (key) {
+	case '\r':
+	case '\n':
+		le->pos = le->len;
+		le->done = true;
+		break;
+	case KEY_CTRL('d'):
+		if (le->len == 0) {
+			le->eof = le->done = true;
+			break;
+		}
+		/* fall through */
+	case KEY_DELETE:
+		if (le->pos < le->len)
+			lineedit_replace(le, le->pos, next_char(le, le->pos), "", 0);
+		le->hist_pos = -1;
+		break;
+	case 127:
+	case KEY_CTRL('h'):
+		if (le->pos > 0)
+			lineedit_replace(le, prev_char(le, le->pos), le->pos, "", 0);
+		le->hist_pos = -1;
+		break;
+	case KEY_CTRL('c'):
+		le->pos = le->len;
+		refresh(le);
+		out_puts(le, "^C\r\n");
+		set_line(le, "", 0);
+		le->hist_pos = -1;
+		break;
+	case KEY_CTRL('a'):
+	case KEY_HOME:
+		le->pos = 0;
+		break;
+	case KEY_CTRL('e'):
+	case KEY_END:
+		le->pos = le->len;
+		break;
+	case KEY_CTRL('b'):
+	case KEY_LEFT:
+		le->pos = prev_char(le, le->pos);
+		break;
+	case KEY_CTRL('f'):
+	case KEY_RIGHT:
+		le->pos = next_char(le, le->pos);
+		break;
+	case KEY_CTRL('k'):
+		lineedit_replace(le, le->pos, le->len, "", 0);
+		le->hist_pos = -1;
+		break;
+	case KEY_CTRL('u'):
+		lineedit_replace(le, 0, le->pos, "", 0);
+		le->pos = 0;
+		le->hist_pos = -1;
+		break;
+	case KEY_CTRL('w'):
+		p = le->pos;
+		while (p > 0 && (le->buf[p - 1] == ' ' || le->buf[p - 1] == '\t'))
+			p--;
+		while (p > 0 && le->buf[p - 1] != ' ' && le->buf[p - 1] != '\t')
+			p--;
+		lineedit_replace(le, p, le->pos, "", 0);
+		le->hist_pos = -1;
+		break;
+	case KEY_CTRL('l'):
+		out_puts(le, "\033[H\033[2J");
+		break;
+	case '\t':
+		if (le->complete) {
+			out_flush(le);
+			le->complete(le, ++le->tab_count);
+			fflush(stdout);
+		}
+		break;
+	case KEY_CTRL('r'):
+		history_sync();
+		le->searching = true;
+		le->query_len = 0;
+		le->found = -1;
+		le->failed = false;
+		break;
+	case KEY_CTRL('p'):
+	case KEY_UP:
+		history_move(le, -1);
+		break;
+	case KEY_CTRL('n'):
+	case KEY_DOWN:
+		history_move(le, 1);
+		break;
+	case KEY_PASTE_START:
+		le->pasting = true;
+		break;
+	case KEY_PASTE_END:
+		le->pasting = false;
+		break;
+	}
+}
+
+static int decode_csi(struct lineedit *le, char final) {
+	le->csi[le->csi_len] = '\0';
+	switch (final) {
+	case 'A':
+		return KEY_UP;
+	case 'B':
+		return KEY_DOWN;
+	case 'C':
+		return KEY_RIGHT;
+	case 'D':
+		return KEY_LEFT;
+	case 'H':
+		return KEY_HOME;
+	case 'F':
+		return KEY_END;
+	case '~':
+		switch (atoi(le->csi)) {
+		case 1:
+		case 7:
+			return KEY_HOME;
+		case 4:
+		case 8:
+			return KEY_END;
+		case 3:
+			return KEY_DELETE;
+		case 200:
+			return KEY_PASTE_START;
+		case 201:
+			return KEY_PASTE_END;
+		}
+	}
+	return KEY_NONE;
+}
+
+// length of the run of bytes at s that can be inserted as they are
+static size_t text_run(const struct lineedit *le, const char *s, size_t n) {
+	size_t i = 0;
+	while (i < n) {
+		unsigned char c = s[i];
+		if (c == 27 || c == 127)
+			break;
+		if (c < 32 && !(le->pasting && (c == '\t' || c == '\n' || c == '\r')))
+			break;
+		i++;
+	}
+	return i;
+}
+
+static void process_input(struct lineedit *le) {
+	while (le->in_pos < le->in_len && !le->done) {
+		char *s = le->in + le->in_pos;
+		unsigned char c = *s;
+		size_t n;
+
+		switch (le->state) {
+		case LE_NORMAL:
+			if (c == 27) {
+				le->state = LE_ESC;
+				le->in_pos++;
+				break;
+			}
+			n = text_run(le, s, le->in_len - le->in_pos);
+			if (n == 0) {
+				le->in_pos++;
+				if (le->pasting)
+					break; // other control bytes in a paste are dropped
+				handle_key(le, c);
+				break;
+			}
+			if (le->pasting) {
+				// the line is a single command, pasted newlines separate words
+				for (size_t i = 0; i < n; i++)
+					if (s[i] == '\n' || s[i] == '\r' || s[i] == '\t')
+						s[i] = ' ';
+			}
+			insert_text(le, s, n);
+			le->in_pos += n;
+			break;
+		case LE_ESC:
+			if (c == '[') {
+				le->state = LE_CSI;
+				le->csi_len = 0;
+				le->in_pos++;
+			} else if (c == 'O') {
+				le->state = LE_SS3;
+				le->in_pos++;
+			} else {
+				// not a sequence we know, drop the ESC and keep the byte
+				le->state = LE_NORMAL;
+			}
+			break;
+		case LE_CSI:
+			le->in_pos++;
+			if (c >= 0x40 && c <= 0x7e) {
+				le->state = LE_NORMAL;
+				handle_key(le, decode_csi(le, c));
+			} else if (le->csi_len < sizeof(le->csi) - 1) {
+				le->csi[le->csi_len++] = c;
+			}
+			break;
+		case LE_SS3:
+			le->in_pos++;
+			le->state = LE_NORMAL;
+			le->csi_len = 0;
+			handle_key(le, decode_csi(le, c));
+			break;
+		}
+	}
+}
+
+static void raw_mode(struct lineedit *le) {
+	struct termios raw;
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &le->saved) < 0)
+		return;
+	raw = le->saved;
+	raw.c_iflag &= ~(ICRNL | IXON);
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0)
+		le->raw = true;
+}
+
+static void cooked_mode(struct lineedit *le) {
+	if (le->raw)
+		tcsetattr(STDIN_FILENO, TCSANOW, &le->saved);
+	le->raw = false;
+}
+
+void lineedit_init(struct lineedit *le) {
+	memset(le, 0, sizeof(*le));
+	grow(&le->buf, &le->cap, 256);
+	le->buf[0] = '\0';
+	le->hist_pos = -1;
+	le->found = -1;
+}
+
+void lineedit_free(struct lineedit *le) {
+	free(le->buf);
+	free(le->out);
+	free(le->hist_prefix);
+	free(le->query);
+	memset(le, 0, sizeof(*le));
+}
+
+/**
+ * Read a line from the terminal. Bytes typed ahead of the newline are
+ * kept for the next call.
+ * @param  le     editor state
+ * @param  prompt prompt to draw in front of the line
+ * @return        0 with the line in le->buf, -1 on end of input
+ */
+int lineedit_read(struct lineedit *le, const char *prompt) {
+	le->prompt = prompt;
+	le->len = le->pos = le->scroll = 0;
+	le->buf[0] = '\0';
+	le->hist_pos = -1;
+	le->searching = le->pasting = false;
+	le->state = LE_NORMAL;
+	le->tab_count = 0;
+	le->done = le->eof = false;
+
+	raw_mode(le);
+	out_puts(le, "\033[?2004h"); // bracketed paste on
+	refresh(le);
+
+	while (!le->done) {
+		if (le->in_pos == le->in_len) {
+			ssize_t n = read(STDIN_FILENO, le->in, sizeof(le->in));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				le->eof = true;
+				break;
+			}
+			le->in_len = n;
+			le->in_pos = 0;
+		}
+		process_input(le);
+		refresh(le);
+	}
+
+	out_puts(le, "\033[?2004l\r\n");
+	out_flush(le);
+	cooked_mode(le);
+	return le->eof ? -1 : 0;
+}
@@ -0,0 +1,64 @@
+#ifndef DASH_LINEEDIT_H
+#define DASH_LINEEDIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <termios.h>
+
+#define LINEEDIT_READ_SIZE 4096
+
+struct lineedit;
+
+// called on Tab, tab_count is the number of consecutive presses
+typedef void (*lineedit_complete_fn)(struct lineedit *le, int tab_count);
+
+struct lineedit {
+	char *buf; // the line, always NUL terminated
+	size_t len;
+	size_t pos; // cursor
+	size_t cap;
+	lineedit_complete_fn complete;
+
+	// everything below is private to lineedit.c
+	const char *prompt;
+	size_t scroll; // first byte of buf shown on screen
+	int tab_count;
+	bool done;
+	bool eof;
+
+	char in[LINEEDIT_READ_SIZE];
+	size_t in_len;
+	size_t in_pos;
+	int state;
+	char csi[16];
+	size_t csi_len;
+	bool pasting;
+
+	char *out;
+	size_t out_len;
+	size_t out_cap;
+
+	long hist_pos; // history entry shown, -1 when editing a new line
+	char *hist_prefix;
+	size_t hist_prefix_len;
+	size_t hist_prefix_cap;
+
+	bool searching;
+	char *query;
+	size_t query_len;
+	size_t query_cap;
+	long found;
+	bool failed;
+
+	bool raw;
+	struct termios saved;
+};
+
+void lineedit_init(struct lineedit *le);
+void lineedit_free(struct lineedit *le);
+int lineedit_read(struct lineedit *le, const char *prompt);
+size_t lineedit_word_start(const struct lineedit *le);
+void lineedit_replace(struct lineedit *le, size_t from, size_t to,
+					  const char *text, size_t len);
+
+#endif
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "copy.h"
+#include "reader.h"
+#include "shell.h"
+
+/*
+ * parallel [-j jobs] [-g] command [args] [::: inputs]
+ *
+ * Runs command once per input with {} replaced by the input (or the input
+ * appended when there is no {}), keeping up to `jobs` of them running.
+ * Inputs come after ::: or one per line from stdin. Like GNU parallel the
+ * command words are joined into a command line, so a quoted command may
+ * contain pipes and redirects. With -g the output of each job is held
+ * back and written in one piece when the job finishes.
+ *
+ * jobs defaults to the number of CPUs. As in GNU parallel, -j 0 runs as
+ * many as possible: one per input after :::, and up to RLIMIT_NPROC (or
+ * PARALLEL_MAX_JOBS when that is unlimited) for inputs from stdin.
+ */
+
+#define PARALLEL_MAX_JOBS 65536 // when RLIMIT_NPROC does not bound -j
+
+struct job {
+	pid_t *pids;
+	int stages;
+	int running; // stages not reaped yet
+	int status; // of the last stage
+	int out_fd; // held back output with -g, else -1
+};
+
+struct inputs {
+	char **args; // after :::, NULL when reading stdin
+	struct line_reader reader;
+};
+
+static char *next_input(struct inputs *in) {
+	size_t len;
+	if (in->args)
+		return *in->args ? *in->args++ : NULL;
+	return reader_next_line(&in->reader, &len);
+}
+
+static void append(char **buf, size_t *len, size_t *cap, const char *s,
+				   size_t n) {
+	if (*len + n + 1 > *cap) {
+		while (*len + n + 1 > *cap)
+			*cap = *cap ? *cap * 2 : 256;
+		*buf = realloc(*buf, *cap);
+		if (!*buf) {
+			perror("parallel");
+			exit(1);
+		}
+	}
+	memcpy(*buf + *len, s, n);
+	*len += n;
+	(*buf)[*len] = '\0';
+}
+
+// append input single-quoted so the parser gives it back as one word
+static void append_quoted(char **buf, size_t *len, size_t *cap,
+						  const char *input) {
+	append(buf, len, cap, "'", 1);
+	for (const char *p = input; *p; p++) {
+		if (*p == '\'')
+			append(buf, len, cap, "'\\''", 4);
+		else
+			append(buf, len, cap, p, 1);
+	}
+	append(buf, len, cap, "'", 1);
+}
+
+static char *build_line(char **words, const char *input) {
+	char *line = NULL;
+	size_t len = 0, cap = 0;
+	bool substituted = false;
+
+	for (int i = 0; words[i]; i++) {
+		const char *w = words[i], *brace;
+		if (i > 0)
+			append(&line, &len, &cap, " ", 1);
+		while ((brace = strstr(w, "{}"))) {
+			append(&line, &len, &cap, w, brace - w);
+			append_quoted(&line, &len, &cap, input);
+			substituted = true;
+			w = brace + 2;
+		}
+		append(&line, &len, &cap, w, strlen(w));
+	}
+	if (!substituted) {
+		append(&line, &len, &cap, " ", 1);
+		append_quoted(&line, &len, &cap, input);
+	}
+	return line;
+}
+
+// copy a finished job's held back output to stdout
+static void flush_output(int fd) {
+	lseek(fd, 0, SEEK_SET);
+	fflush(stdout);
+	copy_fd(fd, STDOUT_FILENO);
+	close(fd);
+}
+
+// the -j value, 0 meaning the most allowed, or -1 after a message if it
+// is not a usable job count
+static long parse_jobs(const char *arg) {
+	struct rlimit nproc;
+	long max = PARALLEL_MAX_JOBS;
+	char *end;
+
+	if (getrlimit(RLIMIT_NPROC, &nproc) == 0 &&
+		nproc.rlim_cur != RLIM_INFINITY && nproc.rlim_cur < (rlim_t)max)
+		max = nproc.rlim_cur;
+	errno = 0;
+	long jobs = strtol(arg, &end, 10);
+	if (errno || end == arg || *end || jobs < 0 || jobs > max) {
+		fprintf(stderr, "parallel: -j %s: not a job count up to %ld\n", arg,
+				max);
+		return -1;
+	}
+	return jobs ? jobs : max;
+}
+
+/**
+ * Start one job through the shell's executor
+ * @return 0 if it started, -1 if the line did not parse or fork failed
+ */
+static int start_job(struct job *job, char **words, const char *input,
+					 bool group) {
+	struct command_t *command = calloc(1, sizeof(struct command_t));
+	char *line = build_line(words, input);
+	int saved_out = -1;
+	int ret = -1;
+
+	job->out_fd = -1;
+	if (parse_command(line, command) < 0 || !command->name[0])
+		goto out;
+
+	job->stages = 0;
+	for (struct command_t *c = command; c; c = c->next)
+		job->stages++;
+	job->pids = calloc(job->stages, sizeof(pid_t));
+	if (!job->pids) {
+		perror("parallel");
+		goto out;
+	}
+
+	if (group) {
+		job->out_fd = memfd_create("parallel", MFD_CLOEXEC);
+		if (job->out_fd >= 0) {
+			fflush(stdout);
+			saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+			dup2(job->out_fd, STDOUT_FILENO);
+		}
+	}
+
+	job->running = start_pipeline(command, job->pids);
+	job->status = 0;
+
+	if (saved_out >= 0) {
+		dup2(saved_out, STDOUT_FILENO);
+		close(saved_out);
+	}
+	if (job->running == job->stages) {
+		ret = 0;
+	} else {
+		// a stage failed to start, wait for the ones that did
+		for (int i = 0; i < job->running; i++)
+			waitpid(job->pids[i], NULL, 0);
+		free(job->pids);
+		job->pids = NULL;
+		if (job->out_fd >= 0)
+			close(job->out_fd);
+	}
+
+out:
+	free_command(command);
+	free(line);
+	return ret;
+}
+
+int builtin_parallel(struct command_t *command) {
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	bool group = false;
+	struct inputs in = { 0 };
+	char **words;
+	int i, failed = 0, running = 0;
+	int stdin_copy = -1;
+
+	for (i = 1; command->args[i] && command->args[i][0] == '-'; i++) {
+		if (strcmp(command->args[i], "-j") == 0 && command->args[i + 1]) {
+			jobs = parse_jobs(command->args[++i]);
+		} else if (strncmp(command->args[i], "-j", 2) == 0) {
+			jobs = parse_jobs(command->args[i] + 2);
+		} else if (strcmp(command->args[i], "-g") == 0) {
+			group = true;
+		} else {
+			break;
+		}
+		if (jobs < 0)
+			return 2;
+	}
+	words = &command->args[i];
+
+	for (i = 0; words[i]; i++) {
+		if (strcmp(words[i], ":::") == 0) {
+			words[i] = NULL;
+			in.args = &words[i + 1];
+			break;
+		}
+	}
+	if (!words[0]) {
+		fprintf(stderr,
+				"Usage: parallel [-j jobs] [-g] command [args] [::: inputs]\n");
+		return 2;
+	}
+	if (in.args) {
+		// no more slots than there are inputs
+		long inputs = 0;
+		while (in.args[inputs])
+			inputs++;
+		if (jobs > inputs)
+			jobs = inputs;
+	}
+	if (jobs < 1)
+		jobs = 1;
+
+	if (!in.args) {
+		// inputs come from stdin, the jobs get /dev/null instead
+		stdin_copy = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+		int null_fd = open("/dev/null", O_RDONLY);
+		if (stdin_copy < 0 || null_fd < 0) {
+			perror("parallel");
+			return 1;
+		}
+		dup2(null_fd, STDIN_FILENO);
+		close(null_fd);
+		reader_init_fd(&in.reader, stdin_copy);
+	}
+
+	struct job *slots = calloc(jobs, sizeof(struct job));
+	bool more = true;
+	if (!slots) {
+		perror("parallel");
+		failed = 1;
+		more = false;
+	}
+
+	while (1) {
+		// fill free slots
+		for (i = 0; more && i < jobs && running < jobs; i++) {
+			if (slots[i].pids)
+				continue;
+			char *input = next_input(&in);
+			if (!input) {
+				more = false;
+				break;
+			}
+			if (start_job(&slots[i], words, input, group) < 0)
+				failed++;
+			else
+				running++;
+		}
+		if (running == 0)
+			break;
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		// find the job the child belongs to, others are background jobs
+		for (i = 0; i < jobs; i++) {
+			struct job *job = &slots[i];
+			int s;
+			for (s = 0; job->pids && s < job->stages; s++) {
+				if (job->pids[s] == pid)
+					break;
+			}
+			if (!job->pids || s == job->stages)
+				continue;
+
+			if (s == job->stages - 1)
+				job->status = wait_status(status);
+			if (--job->running == 0) {
+				if (job->out_fd >= 0)
+					flush_output(job->out_fd);
+				if (job->status != 0)
+					failed++;
+				free(job->pids);
+				job->pids = NULL;
+				running--;
+			}
+			break;
+		}
+	}
+
+	free(slots);
+	if (stdin_copy >= 0) {
+		dup2(stdin_copy, STDIN_FILENO);
+		reader_free(&in.reader); // closes stdin_copy
+	}
+	return failed > 101 ? 101 : failed;
+}
@@ -0,0 +1,266 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "expand.h"
+#include "shell.h"
+
+/**
+ * Prints a command struct
+ * @param struct command_t *
+ */
+void print_command(struct command_t *command) {
+	int i = 0;
+	printf("Command: <%s>\n", command->name);
+	printf("\tIs Background: %s\n", command->background ? "yes" : "no");
+	printf("\tRedirects:\n");
+
+	for (i = 0; i < 3; i++) {
+		printf("\t\t%d: %s\n", i,
+			   command->redirects[i] ? command->redirects[i] : "N/A");
+	}
+
+	printf("\tArguments (%d):\n", command->arg_count);
+
+	for (i = 0; i < command->arg_count; ++i) {
+		printf("\t\tArg %d: %s\n", i, command->args[i]);
+	}
+
+	if (command->next) {
+		printf("\tPiped to:\n");
+		print_command(command->next);
+	}
+}
+
+/**
+ * Release allocated memory of a command. The whole pipeline lives in the
+ * arena of its first command so this is a single arena_free().
+ * @param  command command returned by parse_command()
+ * @return         0
+ */
+int free_command(struct command_t *command) {
+	arena_free(&command->arena);
+	free(command);
+	return 0;
+}
+
+// argument vector of the stage being parsed, grown by doubling in the arena
+struct argv_builder {
+	char **v;
+	int count;
+	int cap;
+};
+
+static void argv_push(struct arena *arena, struct argv_builder *args,
+					  char *arg) {
+	if (args->count == args->cap) {
+		int cap = args->cap ? args->cap * 2 : 8;
+		char **v = arena_alloc(arena, sizeof(char *) * cap);
+		if (args->count)
+			memcpy(v, args->v, sizeof(char *) * args->count);
+		args->v = v;
+		args->cap = cap;
+	}
+	args->v[args->count++] = arg;
+}
+
+static bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool is_operator(char c) {
+	return c == '|' || c == '&' || c == '<' || c == '>';
+}
+
+// terminate the argument list of a stage, args[0] is the command name
+static void finish_stage(struct arena *arena, struct command_t *stage,
+						 struct argv_builder *args) {
+	if (!stage->name) {
+		stage->name = "";
+		argv_push(arena, args, stage->name);
+	}
+	argv_push(arena, args, NULL);
+	stage->args = args->v;
+	stage->arg_count = args->count;
+	memset(args, 0, sizeof(*args));
+}
+
+// the word being parsed as a glob pattern, with quoted wildcards escaped.
+// It is only kept once the word contains one of them.
+struct glob_word {
+	struct arena *arena;
+	char *buf; // scratch shared by all words of the line
+	size_t cap;
+	char *p; // end of the pattern, NULL until it is needed
+	bool glob; // has an unquoted wildcard
+};
+
+// append c to the word at w and to its pattern
+static char *put(struct glob_word *g, const char *word, char *w, char c,
+				 bool quoted) {
+	if (!g->p && strchr("*?[\\", c)) {
+		if (!g->buf)
+			g->buf = arena_alloc(g->arena, g->cap);
+		memcpy(g->buf, word, w - word);
+		g->p = g->buf + (w - word);
+	}
+	if (g->p) {
+		if (quoted && strchr("*?[]\\", c))
+			*g->p++ = '\\';
+		else if (!quoted && strchr("*?[", c))
+			g->glob = true;
+		*g->p++ = c;
+	}
+	*w = c;
+	return w + 1;
+}
+
+static int parse_error(struct command_t *command, const char *msg) {
+	fprintf(stderr, "-%s: %s\n", sysname, msg);
+	command->name = "";
+	command->next = NULL;
+	command->background = false;
+	memset(command->redirects, 0, sizeof(command->redirects));
+	static char *no_args[] = { "", NULL };
+	command->args = no_args;
+	command->arg_count = 2;
+	return -1;
+}
+
+static int parse_line(char *buf, struct command_t *command,
+					  struct glob_cache *cache) {
+	struct arena *arena = &command->arena;
+	struct command_t *stage = command;
+	struct argv_builder args = { 0 };
+	int redirect_index = -1; // redirect waiting for its file name
+	char held = 0; // operator whose byte was overwritten by a word's NUL
+	char *r = buf, *w, *word;
+	size_t len = strlen(buf);
+	struct glob_word g = { .arena = arena, .cap = len * 2 + 2 };
+	char **matches;
+	int n;
+
+	while (1) {
+		char c = held ? held : *r;
+
+		if (is_space(c)) {
+			r++;
+			continue;
+		}
+		held = 0;
+		if (c == '\0' || c == '#') // a word starting with # is a comment
+			break;
+
+		if (is_operator(c)) {
+			r++;
+			if (redirect_index != -1)
+				return parse_error(command, "missing file name for redirection");
+
+			if (c == '|') {
+				if (!stage->name)
+					return parse_error(command, "syntax error near `|'");
+				finish_stage(arena, stage, &args);
+				stage->next = arena_alloc(arena, sizeof(struct command_t));
+				stage = stage->next;
+			} else if (c == '&') {
+				command->background = true;
+			} else if (c == '<') {
+				redirect_index = 0;
+			} else if (*r == '>') {
+				r++;
+				redirect_index = 2;
+			} else {
+				redirect_index = 1;
+			}
+			continue;
+		}
+
+		// a word, unquoted in place; w never passes r
+		word = w = r;
+		g.p = NULL;
+		g.glob = false;
+		while ((c = *r) && !is_space(c) && !is_operator(c)) {
+			if (c == '\\') {
+				r++;
+				if (*r)
+					w = put(&g, word, w, *r++, true);
+			} else if (c == '\'') {
+				r++;
+				while (*r && *r != '\'')
+					w = put(&g, word, w, *r++, true);
+				if (!*r)
+					return parse_error(command, "unterminated quote");
+				r++;
+			} else if (c == '"') {
+				r++;
+				while (*r && *r != '"') {
+					if (*r == '\\' && r[1] && strchr("\"\\$`", r[1]))
+						r++;
+					w = put(&g, word, w, *r++, true);
+				}
+				if (!*r)
+					return parse_error(command, "unterminated quote");
+				r++;
+			} else {
+				w = put(&g, word, w, *r++, false);
+			}
+		}
+
+		if (!is_operator(c)) {
+			if (c)
+				r++;
+		} else if (w == r) {
+			held = c;
+		}
+		*w = '\0';
+
+		n = 0;
+		if (g.glob) {
+			*g.p = '\0';
+			n = glob_expand(cache, arena, g.buf, &matches);
+		}
+
+		if (redirect_index != -1) {
+			if (n > 1)
+				return parse_error(command, "ambiguous redirect");
+			stage->redirects[redirect_index] = n ? matches[0] : word;
+			redirect_index = -1;
+		} else if (n) {
+			if (!stage->name)
+				stage->name = matches[0];
+			for (int i = 0; i < n; i++)
+				argv_push(arena, &args, matches[i]);
+		} else {
+			if (!stage->name)
+				stage->name = word;
+			argv_push(arena, &args, word);
+		}
+	}
+
+	if (redirect_index != -1)
+		return parse_error(command, "missing file name for redirection");
+	if (stage != command && !stage->name)
+		return parse_error(command, "syntax error near `|'");
+	finish_stage(arena, stage, &args);
+
+	return 0;
+}
+
+/**
+ * Parse a command string into a command struct. This is a single pass over
+ * the line: quotes and escapes are removed in place and every word points
+ * into buf, so buf must outlive the command. Pipeline stages and argument
+ * vectors are allocated from the arena of the first command. Words with
+ * unquoted wildcards are replaced by the paths they match, if any.
+ * @param  buf     the line, modified in place
+ * @param  command zeroed command to fill
+ * @return         0 on success, -1 on a syntax error (command is then empty)
+ */
+int parse_command(char *buf, struct command_t *command) {
+	struct glob_cache cache = { 0 };
+	int ret = parse_line(buf, command, &cache);
+	glob_cache_free(&cache);
+	return ret;
+}
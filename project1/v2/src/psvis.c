@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shell.h"
+
+/*
+ * psvis without the kernel module. The pids are listed from /proc with
+ * getdents64, then a pool of threads reads /proc/<pid>/stat for each of
+ * them through openat on one /proc dirfd. The parent links are turned
+ * into child lists and the tree is written in the same DOT format as
+ * /proc/psvis_tree, siblings ordered by start time like the kernel's
+ * children lists.
+ */
+
+#define SCAN_BATCH 64 // pids a thread claims at a time
+#define SCAN_MAX_THREADS 16
+#define COMM_LEN 16 // TASK_COMM_LEN
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct proc_entry {
+	pid_t pid;
+	pid_t ppid;
+	unsigned long long start; // clock ticks after boot
+	bool valid; // false if the process exited before it was read
+	char comm[COMM_LEN];
+};
+
+struct scan {
+	int proc_fd;
+	struct proc_entry *entries;
+	size_t count;
+	atomic_size_t next; // first entry not claimed by a thread
+};
+
+// list the numeric entries of /proc, which come in increasing pid order
+static struct proc_entry *list_pids(int proc_fd, size_t *count) {
+	char buf[65536];
+	struct proc_entry *entries = NULL;
+	size_t cap = 0;
+	long n;
+
+	*count = 0;
+	while ((n = syscall(SYS_getdents64, proc_fd, buf, sizeof(buf))) > 0) {
+		for (long off = 0; off < n;) {
+			struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+			off += d->d_reclen;
+			if (d->d_name[0] < '1' || d->d_name[0] > '9')
+				continue;
+
+			if (*count == cap) {
+				cap = cap ? cap * 2 : 1024;
+				struct proc_entry *grown =
+					realloc(entries, sizeof(struct proc_entry) * cap);
+				if (!grown) {
+					free(entries);
+					return NULL;
+				}
+				entries = grown;
+			}
+			memset(&entries[*count], 0, sizeof(struct proc_entry));
+			entries[(*count)++].pid = atoi(d->d_name);
+		}
+	}
+	if (n < 0) {
+		free(entries);
+		return NULL;
+	}
+	return entries;
+}
+
+// fill in ppid, comm and start time from /proc/<pid>/stat
+static void read_stat(int proc_fd, struct proc_entry *entry) {
+	char path[32], buf[1024];
+	snprintf(path, sizeof(path), "%d/stat", entry->pid);
+
+	int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return;
+	buf[n] = '\0';
+
+	// "pid (comm) state ppid ...", comm may itself contain ") "
+	char *lparen = strchr(buf, '('), *rparen = strrchr(buf, ')');
+	if (!lparen || !rparen || rparen < lparen || !rparen[1] || !rparen[2])
+		return;
+	size_t len = rparen - lparen - 1;
+	if (len >= COMM_LEN)
+		len = COMM_LEN - 1;
+	memcpy(entry->comm, lparen + 1, len);
+	entry->comm[len] = '\0';
+
+	// fields from 4 on are numbers, the start time is field 22
+	char *p = rparen + 4;
+	entry->ppid = strtol(p, &p, 10);
+	for (int field = 5; field < 22; field++)
+		strtoll(p, &p, 10);
+	entry->start = strtoull(p, &p, 10);
+	entry->valid = true;
+}
+
+static void *scan_worker(void *arg) {
+	struct scan *scan = arg;
+	size_t i;
+
+	while ((i = atomic_fetch_add(&scan->next, SCAN_BATCH)) < scan->count) {
+		size_t end = i + SCAN_BATCH < scan->count ? i + SCAN_BATCH : scan->count;
+		for (; i < end; i++)
+			read_stat(scan->proc_fd, &scan->entries[i]);
+	}
+	return NULL;
+}
+
+static void read_all(struct scan *scan) {
+	pthread_t threads[SCAN_MAX_THREADS];
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	long useful = (long)(scan->count / (SCAN_BATCH * 4)) + 1;
+	int started = 0;
+
+	if (n > useful)
+		n = useful;
+	if (n > SCAN_MAX_THREADS)
+		n = SCAN_MAX_THREADS;
+	// the calling thread is one of the workers
+	for (long i = 1; i < n; i++) {
+		if (pthread_create(&threads[started], NULL, scan_worker, scan) == 0)
+			started++;
+	}
+	scan_worker(scan);
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static int cmp_pid(const void *key, const void *elem) {
+	pid_t pid = *(const pid_t *)key;
+	const struct proc_entry *entry = elem;
+	return (pid > entry->pid) - (pid < entry->pid);
+}
+
+static struct proc_entry *entries_sorted; // for cmp_start's qsort
+
+static int cmp_start(const void *a, const void *b) {
+	const struct proc_entry *x = &entries_sorted[*(const size_t *)a];
+	const struct proc_entry *y = &entries_sorted[*(const size_t *)b];
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+/**
+ * Write the process trees under roots as DOT without depending on the
+ * kernel module. As with the module, a task under several roots is only
+ * written under the first.
+ * @param  roots    pids at the top of the trees
+ * @param  nr_roots number of roots
+ * @param  out_fd   where the graph is written
+ * @return          0 on success, 1 on error
+ */
+int psvis_scan(const pid_t *roots, int nr_roots, int out_fd) {
+	struct scan scan = { .proc_fd = -1 };
+	size_t *first = NULL, *kids = NULL, *stack = NULL, *pos = NULL;
+	bool *seen = NULL;
+	FILE *out = NULL;
+	int ret = 1;
+
+	scan.proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (scan.proc_fd < 0) {
+		perror("psvis: /proc");
+		return 1;
+	}
+	scan.entries = list_pids(scan.proc_fd, &scan.count);
+	if (!scan.entries) {
+		perror("psvis: /proc");
+		goto out;
+	}
+	read_all(&scan);
+
+	struct proc_entry *entries = scan.entries;
+	size_t count = scan.count;
+	bool found = false;
+	for (int r = 0; r < nr_roots; r++) {
+		struct proc_entry *top =
+			bsearch(&roots[r], entries, count, sizeof(*entries), cmp_pid);
+		if (top && top->valid)
+			found = true;
+		else
+			fprintf(stderr, "psvis: PID %d not found.\n", roots[r]);
+	}
+	if (!found)
+		goto out;
+
+	// child lists as ranges of kids: kids[first[i]] .. kids[first[i + 1]]
+	first = calloc(count + 1, sizeof(size_t));
+	kids = malloc(sizeof(size_t) * (count ? count : 1));
+	stack = calloc(count, sizeof(size_t));
+	pos = malloc(sizeof(size_t) * count);
+	seen = calloc(count, sizeof(bool));
+	out = fdopen(dup(out_fd), "w");
+	if (!first || !kids || !stack || !pos || !seen || !out) {
+		perror("psvis");
+		goto out;
+	}
+
+	size_t *parent = pos; // reused as scratch until the walk
+	for (size_t i = 0; i < count; i++) {
+		struct proc_entry *p = NULL;
+		if (entries[i].valid && entries[i].ppid > 0)
+			p = bsearch(&entries[i].ppid, entries, count, sizeof(*entries),
+						cmp_pid);
+		parent[i] = p && p->valid ? (size_t)(p - entries) : SIZE_MAX;
+		if (parent[i] != SIZE_MAX)
+			first[parent[i] + 1]++;
+	}
+	for (size_t i = 0; i < count; i++)
+		first[i + 1] += first[i];
+	size_t *filled = stack; // also scratch, zeroed by calloc
+	for (size_t i = 0; i < count; i++) {
+		if (parent[i] != SIZE_MAX)
+			kids[first[parent[i]] + filled[parent[i]]++] = i;
+	}
+	entries_sorted = entries;
+	for (size_t i = 0; i < count; i++) {
+		if (first[i + 1] - first[i] > 1)
+			qsort(kids + first[i], first[i + 1] - first[i], sizeof(size_t),
+				  cmp_start);
+	}
+
+	// depth first, in the order the module writes it
+	fprintf(out, "digraph ProcessTree {\n");
+	for (int r = 0; r < nr_roots; r++) {
+		struct proc_entry *top =
+			bsearch(&roots[r], entries, count, sizeof(*entries), cmp_pid);
+		// left out if it was under an earlier root
+		if (!top || !top->valid || seen[top - entries])
+			continue;
+		size_t depth = 1, t = top - entries;
+		stack[0] = t;
+		pos[0] = first[t];
+		seen[t] = true;
+		fprintf(out, "\"%d\\n%s\";\n", entries[t].pid, entries[t].comm);
+		while (depth > 0) {
+			size_t p = stack[depth - 1];
+			if (pos[depth - 1] == first[p + 1]) {
+				depth--;
+				continue;
+			}
+			size_t c = kids[pos[depth - 1]++];
+			// under an earlier root, or pid reuse during the scan closed a
+			// cycle
+			if (seen[c])
+				continue;
+			seen[c] = true;
+			fprintf(out, "\"%d\\n%s\" -> \"%d\\n%s\";\n", entries[p].pid,
+					entries[p].comm, entries[c].pid, entries[c].comm);
+			fprintf(out, "\"%d\\n%s\";\n", entries[c].pid, entries[c].comm);
+			stack[depth] = c;
+			pos[depth] = first[c];
+			depth++;
+		}
+	}
+	fprintf(out, "}\n");
+	ret = 0;
+
+out:
+	if (out && fclose(out) != 0 && ret == 0) {
+		perror("psvis");
+		ret = 1;
+	}
+	free(first);
+	free(kids);
+	free(stack);
+	free(pos);
+	free(seen);
+	free(scan.entries);
+	close(scan.proc_fd);
+	return ret;
+}
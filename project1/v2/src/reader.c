@@ -0,0 +1,115 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+static void reader_grow(struct line_reader *reader, size_t need) {
+	if (need <= reader->cap)
+		return;
+	size_t cap = reader->cap ? reader->cap : READER_BLOCK_SIZE;
+	while (cap < need)
+		cap *= 2;
+	char *buf = realloc(reader->buf, cap);
+	if (!buf) {
+		perror("reader");
+		exit(1);
+	}
+	reader->buf = buf;
+	reader->cap = cap;
+}
+
+void reader_init_fd(struct line_reader *reader, int fd) {
+	memset(reader, 0, sizeof(*reader));
+	reader->fd = fd;
+	reader_grow(reader, READER_BLOCK_SIZE);
+}
+
+/**
+ * Read lines from an fd the commands they run read as well, like the
+ * shell's own stdin when the script comes from there. Like other shells,
+ * a pipe is read a byte at a time up to the newline, and a seekable fd
+ * in blocks with the offset moved back to the end of the line.
+ */
+void reader_init_shared(struct line_reader *reader, int fd) {
+	reader_init_fd(reader, fd);
+	reader->shared = true;
+	reader->seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+}
+
+void reader_init_string(struct line_reader *reader, const char *s) {
+	size_t len = strlen(s);
+	memset(reader, 0, sizeof(*reader));
+	reader->fd = -1;
+	reader_grow(reader, len + 1);
+	memcpy(reader->buf, s, len);
+	reader->end = len;
+	reader->eof = true;
+}
+
+/**
+ * Return the next line with the newline replaced by NUL. The line lives in
+ * the reader's buffer and is valid until the next call.
+ * @param  reader the reader
+ * @param  len    set to the length of the line
+ * @return        the line or NULL at end of input
+ */
+char *reader_next_line(struct line_reader *reader, size_t *len) {
+	char *nl;
+	size_t scanned = reader->start;
+
+	while (!(nl = memchr(reader->buf + scanned, '\n', reader->end - scanned))) {
+		scanned = reader->end;
+		if (reader->eof)
+			break;
+
+		// move the partial line to the front before reading more
+		if (reader->start > 0) {
+			memmove(reader->buf, reader->buf + reader->start,
+					reader->end - reader->start);
+			reader->end -= reader->start;
+			scanned -= reader->start;
+			reader->start = 0;
+		}
+		reader_grow(reader, reader->end + READER_BLOCK_SIZE + 1);
+		size_t want = reader->cap - reader->end - 1;
+		if (reader->shared)
+			want = reader->seekable ? READER_SHARED_BLOCK : 1;
+		ssize_t n = read(reader->fd, reader->buf + reader->end, want);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			reader->eof = true;
+		else
+			reader->end += n;
+	}
+
+	char *line = reader->buf + reader->start;
+	if (nl) {
+		*nl = '\0';
+		*len = nl - line;
+		reader->start = nl - reader->buf + 1;
+		// hand what was read past the line back to the fd
+		if (reader->shared && reader->end > reader->start &&
+			lseek(reader->fd, -(off_t)(reader->end - reader->start),
+				  SEEK_CUR) >= 0)
+			reader->end = reader->start;
+	} else {
+		// last line without a newline
+		if (reader->start == reader->end)
+			return NULL;
+		reader->buf[reader->end] = '\0';
+		*len = reader->end - reader->start;
+		reader->start = reader->end;
+	}
+	return line;
+}
+
+void reader_free(struct line_reader *reader) {
+	if (reader->fd > STDIN_FILENO)
+		close(reader->fd);
+	free(reader->buf);
+	memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,28 @@
+#ifndef DASH_READER_H
+#define DASH_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define READER_BLOCK_SIZE 65536
+#define READER_SHARED_BLOCK 4096 // read ahead of a seekable shared fd
+
+// buffered line reader for scripts, -c strings and piped stdin
+struct line_reader {
+	int fd; // -1 when reading from a string
+	char *buf;
+	size_t start; // first byte not yet returned
+	size_t end; // end of valid data
+	size_t cap;
+	bool eof;
+	bool shared; // the commands read the fd too, so no line is read past
+	bool seekable; // shared only: read ahead, then seek back to the line end
+};
+
+void reader_init_fd(struct line_reader *reader, int fd);
+void reader_init_shared(struct line_reader *reader, int fd);
+void reader_init_string(struct line_reader *reader, const char *s);
+char *reader_next_line(struct line_reader *reader, size_t *len);
+void reader_free(struct line_reader *reader);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef DASH_SHELL_H
+#define DASH_SHELL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "arena.h"
+
+extern const char *sysname;
+extern int last_status; // exit status of the last command
+
+enum return_codes {
+	SUCCESS = 0,
+	EXIT = 1,
+	UNKNOWN = 2,
+};
+
+struct command_t {
+	char *name;
+	bool background;
+	int arg_count;
+	char **args;
+	char *redirects[3]; // in/out redirection
+	struct command_t *next; // for piping
+	struct arena arena; // owns the pipeline, only used on the first command
+};
+
+// builtins run in the shell when alone and in a child inside a pipeline
+typedef int (*builtin_fn)(struct command_t *command);
+
+struct builtin {
+	const char *name;
+	builtin_fn fn; // returns the exit status
+};
+
+extern bool exit_requested; // set by the exit builtin
+
+const struct builtin *find_builtin(const char *name);
+int kuhex(const char *file_path, int group_size, FILE *output_stream);
+int kuhex_reverse(const char *dump_path, const char *out_path);
+int psvis_command(char *const *pids, int nr_pids, const char *output_file);
+int psvis_module(const char *query, int out_fd);
+int psvis_scan(const pid_t *roots, int nr_roots, int out_fd);
+int psvis_watch(pid_t root, long max_events, FILE *out);
+int builtin_parallel(struct command_t *command);
+
+void print_command(struct command_t *command);
+int free_command(struct command_t *command);
+int parse_command(char *buf, struct command_t *command);
+int process_command(struct command_t *command);
+int start_pipeline(struct command_t *command, pid_t *pids);
+int apply_redirects(struct command_t *command);
+void exec_external(struct command_t *command);
+int wait_status(int status);
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+/*
+ * Session statistics: a latency histogram per command name and one per
+ * executor phase. Recording is a clock read and a few increments so it
+ * stays on all the time.
+ */
+
+struct command_stats {
+	char *name;
+	struct stats_hist hist;
+};
+
+static const char *phase_names[STATS_PHASES] = { "fork", "exec", "wait" };
+static struct stats_hist phases[STATS_PHASES];
+static struct command_stats commands[STATS_MAX_COMMANDS];
+static int command_count;
+
+// monotonic time in microseconds
+double stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void hist_add(struct stats_hist *hist, double usec) {
+	int bucket = 0;
+	unsigned long v = usec > 1 ? (unsigned long)usec : 1;
+	while (v > 1 && bucket < STATS_BUCKETS - 1) {
+		v >>= 1;
+		bucket++;
+	}
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->total += usec;
+	if (usec > hist->max)
+		hist->max = usec;
+}
+
+// upper bound of the bucket holding the given percentile
+static double hist_percentile(const struct stats_hist *hist, double pct) {
+	unsigned long want = (unsigned long)(hist->count * pct / 100.0 + 0.5);
+	unsigned long seen = 0;
+	if (want == 0)
+		want = 1;
+	for (int i = 0; i < STATS_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= want) {
+			double bound = (double)(2UL << i);
+			return bound < hist->max ? bound : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+void stats_record_phase(enum stats_phase phase, double usec) {
+	hist_add(&phases[phase], usec);
+}
+
+void stats_record_command(const char *name, double usec) {
+	int i;
+	for (i = 0; i < command_count; i++) {
+		if (strcmp(commands[i].name, name) == 0)
+			break;
+	}
+	if (i == command_count) {
+		if (command_count == STATS_MAX_COMMANDS)
+			return;
+		commands[i].name = strdup(name);
+		if (!commands[i].name)
+			return;
+		command_count++;
+	}
+	hist_add(&commands[i].hist, usec);
+}
+
+static void print_row(FILE *out, const char *name,
+					  const struct stats_hist *hist, bool verbose) {
+	if (hist->count == 0)
+		return;
+	fprintf(out, "%-16s %8lu %10.1f %10.1f %10.1f %10.1f\n", name,
+			hist->count, hist->total / hist->count,
+			hist_percentile(hist, 50), hist_percentile(hist, 99), hist->max);
+	if (!verbose)
+		return;
+	for (int i = 0; i < STATS_BUCKETS; i++) {
+		if (hist->buckets[i])
+			fprintf(out, "    < %10lu us %8lu\n", 2UL << i, hist->buckets[i]);
+	}
+}
+
+/**
+ * Print the session statistics, times are in microseconds
+ * @param out     where to print
+ * @param verbose also print the histogram buckets
+ */
+void stats_print(FILE *out, bool verbose) {
+	const char *header = "%-16s %8s %10s %10s %10s %10s\n";
+	fprintf(out, header, "phase", "count", "mean", "p50", "p99", "max");
+	for (int i = 0; i < STATS_PHASES; i++)
+		print_row(out, phase_names[i], &phases[i], verbose);
+	fprintf(out, "\n");
+	fprintf(out, header, "command", "count", "mean", "p50", "p99", "max");
+	for (int i = 0; i < command_count; i++)
+		print_row(out, commands[i].name, &commands[i].hist, verbose);
+}
+
+void stats_reset(void) {
+	for (int i = 0; i < command_count; i++)
+		free(commands[i].name);
+	memset(commands, 0, sizeof(commands));
+	memset(phases, 0, sizeof(phases));
+	command_count = 0;
+}
@@ -0,0 +1,30 @@
+#ifndef DASH_STATS_H
+#define DASH_STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define STATS_BUCKETS 32 // log2 buckets of microseconds
+#define STATS_MAX_COMMANDS 256
+
+enum stats_phase {
+	STATS_FORK, // fork() in the parent
+	STATS_EXEC, // fork returned until the child exec'd
+	STATS_WAIT, // last stage started until every stage was reaped
+	STATS_PHASES,
+};
+
+struct stats_hist {
+	unsigned long count;
+	double total; // microseconds
+	double max;
+	unsigned long buckets[STATS_BUCKETS];
+};
+
+double stats_now(void);
+void stats_record_phase(enum stats_phase phase, double usec);
+void stats_record_command(const char *name, double usec);
+void stats_print(FILE *out, bool verbose);
+void stats_reset(void);
+
+#endif
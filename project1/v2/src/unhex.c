@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shell.h"
+
+/*
+ * kuhex -r: turn a kuhex dump back into the bytes it was made from. Every
+ * line carries its own offset, so the dump is cut into chunks at line
+ * boundaries and each thread decodes one chunk on its own, writing with
+ * pwrite at the offsets in the dump. Consecutive lines are gathered into
+ * one write, and offsets no line covers are left as holes in the output.
+ *
+ * A line is "OFFSET: " followed by the bytes in hex, groups of any size
+ * separated by one space, up to 16 bytes or two spaces in a row. What
+ * follows, the ASCII column, is ignored, so the group size does not need
+ * to be known.
+ */
+
+#define UNHEX_MAX_THREADS 16
+#define UNHEX_MIN_CHUNK (1 << 20) // dump bytes worth a thread
+#define UNHEX_RUN_SIZE (1 << 20) // output gathered into one pwrite
+#define LINE_BYTES 16
+
+// hex digit values with HEX_DIGIT set, 0 for anything else
+#define HEX_DIGIT 0x10
+static const uint8_t hex_value[256] = {
+	['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+	['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+	['a'] = 0x1a, ['b'] = 0x1b, ['c'] = 0x1c, ['d'] = 0x1d, ['e'] = 0x1e,
+	['f'] = 0x1f, ['A'] = 0x1a, ['B'] = 0x1b, ['C'] = 0x1c, ['D'] = 0x1d,
+	['E'] = 0x1e, ['F'] = 0x1f,
+};
+
+struct unhex_chunk {
+	const char *start, *end;
+	const char *dump; // start of the whole dump, for error positions
+	int out_fd;
+	unsigned char *run; // UNHEX_RUN_SIZE bytes waiting to be written
+	uint64_t run_offset;
+	size_t run_len;
+	int err; // errno of a failed write
+	bool bad; // stopped at a malformed line
+	size_t bad_line; // its offset in the dump
+};
+
+// decode one line, returns the number of bytes or -1 if it is malformed
+static int decode_line(const char *p, const char *end, uint64_t *offset,
+					   unsigned char *out) {
+	uint64_t off = 0;
+	int digits = 0, n = 0;
+
+	for (; p < end && (hex_value[(unsigned char)*p] & HEX_DIGIT);
+		 p++, digits++)
+		off = off << 4 | (hex_value[(unsigned char)*p] & 0xf);
+	if (!digits || digits > 16 || end - p < 2 || p[0] != ':' || p[1] != ' ')
+		return -1;
+
+	for (p += 2; n < LINE_BYTES && end - p >= 2;) {
+		if (p[0] == ' ') {
+			if (p[1] == ' ')
+				break;
+			p++;
+			continue;
+		}
+		uint8_t hi = hex_value[(unsigned char)p[0]];
+		uint8_t lo = hex_value[(unsigned char)p[1]];
+		if (!(hi & lo & HEX_DIGIT))
+			return -1;
+		out[n++] = (hi & 0xf) << 4 | (lo & 0xf);
+		p += 2;
+	}
+	*offset = off;
+	return n;
+}
+
+static int flush_run(struct unhex_chunk *chunk) {
+	for (size_t done = 0; done < chunk->run_len;) {
+		ssize_t n = pwrite(chunk->out_fd, chunk->run + done,
+						   chunk->run_len - done, chunk->run_offset + done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			chunk->err = errno;
+			return -1;
+		}
+		done += n;
+	}
+	chunk->run_len = 0;
+	return 0;
+}
+
+static void *unhex_worker(void *arg) {
+	struct unhex_chunk *chunk = arg;
+	unsigned char bytes[LINE_BYTES];
+	uint64_t offset;
+
+	for (const char *line = chunk->start, *nl; line < chunk->end;
+		 line = nl + 1) {
+		nl = memchr(line, '\n', chunk->end - line);
+		if (!nl)
+			nl = chunk->end;
+		if (nl == line)
+			continue;
+
+		int n = decode_line(line, nl, &offset, bytes);
+		if (n < 0) {
+			chunk->bad = true;
+			chunk->bad_line = line - chunk->dump;
+			return NULL;
+		}
+		if (chunk->run_len &&
+			(offset != chunk->run_offset + chunk->run_len ||
+			 chunk->run_len + n > UNHEX_RUN_SIZE) &&
+			flush_run(chunk) < 0)
+			return NULL;
+		if (!chunk->run_len)
+			chunk->run_offset = offset;
+		memcpy(chunk->run + chunk->run_len, bytes, n);
+		chunk->run_len += n;
+	}
+	flush_run(chunk);
+	return NULL;
+}
+
+// the dump in memory, mapped when it is a file and read otherwise
+static char *load_dump(int fd, size_t *len, bool *mapped) {
+	struct stat st;
+	char *buf = NULL;
+	size_t cap = 0;
+	ssize_t n;
+
+	*len = 0;
+	*mapped = false;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf != MAP_FAILED) {
+			madvise(buf, st.st_size, MADV_SEQUENTIAL);
+			*len = st.st_size;
+			*mapped = true;
+			return buf;
+		}
+		buf = NULL;
+	}
+
+	do {
+		if (*len == cap) {
+			cap = cap ? cap * 2 : 65536;
+			char *grown = realloc(buf, cap);
+			if (!grown) {
+				free(buf);
+				return NULL;
+			}
+			buf = grown;
+		}
+		n = read(fd, buf + *len, cap - *len);
+		if (n > 0)
+			*len += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+	if (n < 0) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/**
+ * Rebuild a file from a kuhex dump of any group size
+ * @param  dump_path the dump, as written by kuhex
+ * @param  out_path  file to write the bytes to, truncated first
+ * @return           0 on success, 1 on error
+ */
+int kuhex_reverse(const char *dump_path, const char *out_path) {
+	struct unhex_chunk chunks[UNHEX_MAX_THREADS] = { 0 };
+	pthread_t threads[UNHEX_MAX_THREADS];
+	bool mapped, started[UNHEX_MAX_THREADS] = { false };
+	size_t len;
+	int ret = 1, out_fd = -1, nr_chunks = 0;
+
+	int in_fd = open(dump_path, O_RDONLY | O_CLOEXEC);
+	if (in_fd < 0) {
+		perror("kuhex: error opening the dump");
+		return 1;
+	}
+	char *dump = load_dump(in_fd, &len, &mapped);
+	if (!dump) {
+		perror("kuhex: error reading the dump");
+		close(in_fd);
+		return 1;
+	}
+	out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out_fd < 0) {
+		perror("kuhex: error opening the output file");
+		goto out;
+	}
+
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	long useful = (long)(len / UNHEX_MIN_CHUNK) + 1;
+	if (n > useful)
+		n = useful;
+	if (n > UNHEX_MAX_THREADS)
+		n = UNHEX_MAX_THREADS;
+	if (n < 1)
+		n = 1;
+
+	// equal chunks, each moved on to the start of a line
+	const char *start = dump, *end = dump + len;
+	for (long i = 0; i < n && start < end; i++) {
+		const char *stop = i + 1 == n ? end : dump + len / n * (i + 1);
+		if (stop < start)
+			stop = start;
+		const char *nl = memchr(stop, '\n', end - stop);
+		stop = nl ? nl + 1 : end;
+
+		struct unhex_chunk *chunk = &chunks[nr_chunks++];
+		chunk->start = start;
+		chunk->end = stop;
+		chunk->dump = dump;
+		chunk->out_fd = out_fd;
+		chunk->run = malloc(UNHEX_RUN_SIZE);
+		if (!chunk->run) {
+			perror("kuhex");
+			goto out;
+		}
+		start = stop;
+	}
+
+	// the calling thread takes the first chunk
+	for (int i = 1; i < nr_chunks; i++)
+		started[i] = pthread_create(&threads[i], NULL, unhex_worker,
+									&chunks[i]) == 0;
+	for (int i = 0; i < nr_chunks; i++) {
+		if (i == 0 || !started[i])
+			unhex_worker(&chunks[i]);
+	}
+	for (int i = 1; i < nr_chunks; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+	}
+
+	ret = 0;
+	for (int i = 0; i < nr_chunks && !ret; i++) {
+		if (chunks[i].bad) {
+			fprintf(stderr, "kuhex: %s: not a kuhex dump at byte %zu\n",
+					dump_path, chunks[i].bad_line);
+			ret = 1;
+		} else if (chunks[i].err) {
+			fprintf(stderr, "kuhex: error writing %s: %s\n", out_path,
+					strerror(chunks[i].err));
+			ret = 1;
+		}
+	}
+
+out:
+	for (int i = 0; i < nr_chunks; i++)
+		free(chunks[i].run);
+	if (out_fd >= 0 && close(out_fd) < 0 && ret == 0) {
+		perror("kuhex: error writing the output file");
+		ret = 1;
+	}
+	if (mapped)
+		munmap(dump, len);
+	else
+		free(dump);
+	close(in_fd);
+	return ret;
+}
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../module/psvis.h"
+#include "shell.h"
+
+/*
+ * psvis -w: follow a process tree as it changes. The events file is
+ * opened first so nothing that happens while the snapshot is read from
+ * /proc/psvis_records is missed, then every fork, exec and exit event is
+ * applied to the set of pids in the tree and printed as one line:
+ *
+ *   = PID COMM   in the snapshot, indented by depth
+ *   + PID COMM   forked by a process in the tree
+ *   ~ PID COMM   exec'd a new program
+ *   - PID COMM   exited
+ *
+ * Threads are left out, as in the tree itself. When the module reports
+ * lost events the set can no longer be trusted and a new snapshot is
+ * taken.
+ */
+
+#define EVENTS_PATH "/proc/" PSVIS_EVENTS_NAME
+#define RECORDS_PATH "/proc/" PSVIS_RECORDS_NAME
+#define EVENT_BATCH 64
+
+// open addressing, 0 is a free slot and -1 a removed one
+struct pid_set {
+	pid_t *slots;
+	size_t cap; // a power of two
+	size_t used; // pids and removed slots
+};
+
+static size_t pid_slot(const struct pid_set *set, pid_t pid) {
+	size_t i = ((uint32_t)pid * 2654435761u) & (set->cap - 1);
+	while (set->slots[i] != 0 && set->slots[i] != pid)
+		i = (i + 1) & (set->cap - 1);
+	return i;
+}
+
+static bool pid_set_has(const struct pid_set *set, pid_t pid) {
+	return set->cap && set->slots[pid_slot(set, pid)] == pid;
+}
+
+static int pid_set_grow(struct pid_set *set) {
+	struct pid_set grown = { .cap = set->cap ? set->cap * 2 : 1024 };
+
+	grown.slots = calloc(grown.cap, sizeof(pid_t));
+	if (!grown.slots)
+		return -1;
+	for (size_t i = 0; i < set->cap; i++) {
+		if (set->slots[i] > 0) {
+			grown.slots[pid_slot(&grown, set->slots[i])] = set->slots[i];
+			grown.used++;
+		}
+	}
+	free(set->slots);
+	*set = grown;
+	return 0;
+}
+
+// returns true if pid was not in the set yet
+static bool pid_set_add(struct pid_set *set, pid_t pid) {
+	if ((set->used + 1) * 2 > set->cap && pid_set_grow(set) < 0)
+		return false;
+	size_t i = pid_slot(set, pid);
+	if (set->slots[i] == pid)
+		return false;
+	set->slots[i] = pid;
+	set->used++;
+	return true;
+}
+
+// removed slots keep probe chains intact until the next grow
+static bool pid_set_remove(struct pid_set *set, pid_t pid) {
+	if (!set->cap)
+		return false;
+	size_t i = pid_slot(set, pid);
+	if (set->slots[i] != pid)
+		return false;
+	set->slots[i] = -1;
+	return true;
+}
+
+// read the subtree of root into set and print it, -1 if root is gone
+static int snapshot(pid_t root, struct pid_set *set, FILE *out) {
+	char query[32];
+	char *buf = NULL;
+	size_t len = 0, cap = 0;
+	ssize_t n;
+	int ret = -1;
+
+	int fd = open(RECORDS_PATH, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		perror("psvis: " RECORDS_PATH);
+		return -1;
+	}
+	int qlen = snprintf(query, sizeof(query), "%d", root);
+	if (write(fd, query, qlen) < 0) {
+		perror("psvis: " RECORDS_PATH);
+		goto out;
+	}
+	do {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 65536;
+			char *grown = realloc(buf, cap);
+			if (!grown) {
+				perror("psvis");
+				goto out;
+			}
+			buf = grown;
+		}
+		n = read(fd, buf + len, cap - len);
+		if (n < 0 && errno != EINTR) {
+			if (errno == ESRCH)
+				fprintf(stderr, "psvis: PID %d not found.\n", root);
+			else
+				perror("psvis: " RECORDS_PATH);
+			goto out;
+		}
+		if (n > 0)
+			len += n;
+	} while (n != 0);
+
+	memset(set->slots, 0, sizeof(pid_t) * set->cap);
+	set->used = 0;
+	for (size_t off = 0; off + PSVIS_RECORD_V1_SIZE <= len;) {
+		struct psvis_record rec = { 0 };
+		memcpy(&rec, buf + off, PSVIS_RECORD_V1_SIZE);
+		if (rec.size < PSVIS_RECORD_V1_SIZE)
+			break;
+		off += rec.size;
+		pid_set_add(set, rec.pid);
+		fprintf(out, "= %*s%d %.*s\n", (int)rec.depth * 2, "", rec.pid,
+				PSVIS_COMM_LEN, rec.comm);
+	}
+	fflush(out);
+	ret = 0;
+
+out:
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+/**
+ * Print the changes to the process tree under root as they happen
+ * @param  root       pid at the top of the tree
+ * @param  max_events stop after this many changes, 0 to follow until
+ *                    root exits
+ * @param  out        where the changes are printed
+ * @return            0 on success, 1 on error
+ */
+int psvis_watch(pid_t root, long max_events, FILE *out) {
+	struct psvis_event events[EVENT_BATCH];
+	struct pid_set set = { 0 };
+	long changes = 0;
+	int ret = 1;
+
+	int fd = open(EVENTS_PATH, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			fprintf(stderr, "psvis: -w needs the psvis module\n");
+		else
+			perror("psvis: " EVENTS_PATH);
+		return 1;
+	}
+	if (pid_set_grow(&set) < 0) {
+		perror("psvis");
+		goto out;
+	}
+	if (snapshot(root, &set, out) < 0)
+		goto out;
+
+	for (;;) {
+		ssize_t n = read(fd, events, sizeof(events));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("psvis: " EVENTS_PATH);
+			goto out;
+		}
+
+		for (ssize_t i = 0; i < n / (ssize_t)sizeof(events[0]); i++) {
+			struct psvis_event *ev = &events[i];
+			char sign = 0;
+
+			switch (ev->type) {
+			case PSVIS_EVENT_FORK:
+				if (ev->pid == ev->tgid && pid_set_has(&set, ev->ppid) &&
+					pid_set_add(&set, ev->pid))
+					sign = '+';
+				break;
+			case PSVIS_EVENT_EXEC:
+				if (pid_set_has(&set, ev->tgid))
+					sign = '~';
+				break;
+			case PSVIS_EVENT_EXIT:
+				if (ev->pid == ev->tgid && pid_set_remove(&set, ev->pid))
+					sign = '-';
+				break;
+			case PSVIS_EVENT_OVERFLOW:
+				fprintf(out, "! %u events lost, reading the tree again\n",
+						ev->lost);
+				if (snapshot(root, &set, out) < 0) {
+					ret = 0; // root exited while the events were lost
+					goto out;
+				}
+				break;
+			}
+			if (!sign)
+				continue;
+
+			fprintf(out, "%c %d %.*s\n", sign, ev->tgid, PSVIS_COMM_LEN,
+					ev->comm);
+			if (++changes == max_events ||
+				(sign == '-' && ev->pid == root)) {
+				ret = 0;
+				goto out;
+			}
+		}
+		fflush(out);
+	}
+
+out:
+	fflush(out);
+	free(set.slots);
+	close(fd);
+	return ret;
+}